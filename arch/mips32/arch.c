@@ -5,7 +5,7 @@
 // Virtual Memor
 
 unsigned int* const CHAR_VRAM = (unsigned int*)0xbfc04000;
-unsigned int* const GRAPHIC_VRAM = (unsigned int*)0xbfe0000;
+unsigned int* GRAPHIC_VRAM = (unsigned int*)0xbfe00000;
 unsigned int* const GPIO_SWITCH = (unsigned int*)0xbfc09000;     // switch read-only
 unsigned int* const GPIO_BUTTON = (unsigned int*)0xbfc09004;     // button read-only
 unsigned int* const GPIO_SEG = (unsigned int*)0xbfc09008;        // Seg R/W
@@ -22,4 +22,10 @@ volatile unsigned int kernel_sp = 0x81000000;
 
 unsigned int get_phymm_size() {
     return MACHINE_MMSIZE;
-}
\ No newline at end of file
+}
+
+unsigned int get_cp0_count() {
+    unsigned int count;
+    asm volatile("mfc0 %0, $9\n\t" : "=r"(count));
+    return count;
+}
@@ -8,6 +8,8 @@
 #define CHAR_VRAM_SIZE 128 * 32 * 4          // 128*32*4
 #define PAGE_TABLE_SIZE 256 * 1024           // 4MB
 #define GRAPHIC_VRAM_SIZE 1024 * 512 * 4     // 1024*512*4 b-g-r
+#define GRAPHIC_VRAM_PA 0x1fe00000           // 2MB aligned, one wired TLB entry of two 1MB pages
+#define L1_CACHE_BYTES 32                    // line size of the I/D caches
 
 //	Virtual Memory
 #define BIOS_ENTRY 0xbfc00000
@@ -17,7 +19,7 @@
 #define USER_ENTRY 0x00000000
 
 extern unsigned int* const CHAR_VRAM;
-extern unsigned int* const GRAPHIC_VRAM;
+extern unsigned int* GRAPHIC_VRAM;          // kseg1 until init_vram() maps it with large pages
 extern unsigned int* const GPIO_SWITCH;     // switch read-only
 extern unsigned int* const GPIO_BUTTON;     // button read-only
 extern unsigned int* const GPIO_SEG;        // Seg R/W
@@ -46,4 +48,7 @@ extern volatile unsigned int kernel_sp;
 
 unsigned int get_phymm_size();
 
+// CP0 count register($9), for cycle measurement
+unsigned int get_cp0_count();
+
 #endif
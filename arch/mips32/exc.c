@@ -14,18 +14,23 @@ void do_exceptions(unsigned int status, unsigned int cause, context* pt_context)
     if (exceptions[index]) {
         exceptions[index](status, cause, pt_context);
     } else {
-        task_struct* pcb;
-        unsigned int badVaddr;
-        asm volatile("mfc0 %0, $8\n\t" : "=r"(badVaddr));
-        pcb = get_curr_pcb();
-        kernel_printf("\nProcess %s exited due to exception cause=%x;\n", pcb->name, cause);
-        kernel_printf("status=%x, EPC=%x, BadVaddr=%x\n", status, pcb->context.epc, badVaddr);
-        pc_kill_syscall(status, cause, pt_context);
-        while (1)
-            ;
+        exc_kill(status, cause, pt_context);
     }
 }
 
+// the exception can not be handled, the current process is killed
+void exc_kill(unsigned int status, unsigned int cause, context* pt_context) {
+    task_struct* pcb;
+    unsigned int badVaddr;
+    asm volatile("mfc0 %0, $8\n\t" : "=r"(badVaddr));
+    pcb = get_curr_pcb();
+    kernel_printf("\nProcess %s exited due to exception cause=%x;\n", pcb->name, cause);
+    kernel_printf("status=%x, EPC=%x, BadVaddr=%x\n", status, pt_context->epc, badVaddr);
+    pc_kill_syscall(status, cause, pt_context);
+    while (1)
+        ;
+}
+
 void register_exception_handler(int index, exc_fn fn) {
     index &= 31;
     exceptions[index] = fn;
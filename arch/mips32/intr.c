@@ -41,6 +41,13 @@ int disable_interrupts() {
     return old;
 }
 
+// status.EXL is set while handling an exception or interrupt
+int in_interrupt() {
+    int status;
+    asm volatile("mfc0 %0, $12\n\t" : "=r"(status));
+    return status & 0x2;
+}
+
 void do_interrupts(unsigned int status, unsigned int cause, context* pt_context) {
     int i;
     int index = cause >> 8;
@@ -10,6 +10,7 @@ extern intr_fn interrupts[8];
 void init_interrupts();
 int enable_interrupts();
 int disable_interrupts();
+int in_interrupt();
 void do_interrupts(unsigned int status, unsigned int cause, context* pt_context);
 void register_interrupt_handler(int index, intr_fn fn);
 
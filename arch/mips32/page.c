@@ -21,6 +21,215 @@ void init_pgtable() {
         "bne $v0, $v1, init_pgtable_L1\n\t"
         "tlbwi\n\t"
         "nop");
+    init_tlb_wired();
+}
+
+// drop every non-global TLB entry of (asid), the current EntryHi is kept
+void tlb_flush_asid(unsigned int asid) {
+    unsigned int entryhi, pagemask, hi, lo0, lo1;
+    unsigned int index;
+
+    // tlbr below loads PageMask and EntryHi too, so both are put back at the end
+    asm volatile(
+        "mfc0 %0, $10\n\t"
+        "mfc0 %1, $5"
+        : "=r"(entryhi), "=r"(pagemask));
+    for (index = 0; index < TLB_ENTRIES; index++) {
+        asm volatile(
+            "mtc0 %3, $0\n\t"
+            "nop\n\t"
+            "nop\n\t"
+            "tlbr\n\t"
+            "nop\n\t"
+            "nop\n\t"
+            "mfc0 %0, $10\n\t"
+            "mfc0 %1, $2\n\t"
+            "mfc0 %2, $3"
+            : "=r"(hi), "=r"(lo0), "=r"(lo1)
+            : "r"(index));
+        if ((hi & 0xff) != asid || (lo0 & lo1 & ENTRYLO_G))
+            continue;
+        asm volatile(
+            "mtc0 $zero, $2\n\t"
+            "mtc0 $zero, $3\n\t"
+            "mtc0 $zero, $5\n\t"
+            "mtc0 %0, $10\n\t"
+            "nop\n\t"
+            "nop\n\t"
+            "tlbwi\n\t"
+            "nop"
+            :
+            : "r"(0x80000000 + (index << 13)));
+    }
+    asm volatile(
+        "mtc0 %1, $5\n\t"
+        "mtc0 %0, $10\n\t"
+        "nop\n\t"
+        "nop"
+        :
+        : "r"(entryhi), "r"(pagemask));
+}
+
+/*
+ * drop the TLB entry mapping (va), if any, the current EntryHi (ASID) is kept
+ * the entry is pointed at a kseg0 VPN2 of its own, which is never translated
+ */
+void tlb_flush_page(unsigned int va) {
+    unsigned int entryhi, index;
+
+    asm volatile("mfc0 %0, $10\n\t" : "=r"(entryhi));
+    asm volatile(
+        "mtc0 %1, $10\n\t"
+        "nop\n\t"
+        "nop\n\t"
+        "tlbp\n\t"
+        "nop\n\t"
+        "nop\n\t"
+        "mfc0 %0, $0"
+        : "=r"(index)
+        : "r"((va & 0xffffe000) | (entryhi & 0xff)));
+    if (!(index & 0x80000000)) {
+        asm volatile(
+            "mtc0 $zero, $2\n\t"
+            "mtc0 $zero, $3\n\t"
+            "mtc0 %0, $10\n\t"
+            "nop\n\t"
+            "nop\n\t"
+            "tlbwi\n\t"
+            "nop"
+            :
+            : "r"(0x80000000 + (index << 13)));
+    }
+    asm volatile(
+        "mtc0 %0, $10\n\t"
+        "nop\n\t"
+        "nop"
+        :
+        : "r"(entryhi));
+}
+
+/*
+ * write the pair of 4KB pages holding (va) for (asid) into the TLB, over the entry
+ * that maps it already if there is one, else into a random one, EntryHi is kept
+ * return 1 if no entry mapped the pair
+ */
+int tlb_update_page(unsigned int va, unsigned int asid, unsigned int lo0, unsigned int lo1) {
+    unsigned int entryhi, index;
+
+    asm volatile("mfc0 %0, $10\n\t" : "=r"(entryhi));
+    asm volatile(
+        "mtc0 %1, $10\n\t"
+        "nop\n\t"
+        "nop\n\t"
+        "tlbp\n\t"
+        "nop\n\t"
+        "nop\n\t"
+        "mfc0 %0, $0"
+        : "=r"(index)
+        : "r"((va & 0xffffe000) | (asid & 0xff)));
+    asm volatile(
+        "mtc0 %0, $2\n\t"
+        "mtc0 %1, $3\n\t"
+        "mtc0 $zero, $5\n\t"
+        "nop\n\t"
+        "nop"
+        :
+        : "r"(lo0), "r"(lo1));
+    if (index & 0x80000000)
+        asm volatile("tlbwr\n\tnop");
+    else
+        asm volatile("tlbwi\n\tnop");
+    asm volatile(
+        "mtc0 %0, $10\n\t"
+        "nop\n\t"
+        "nop"
+        :
+        : "r"(entryhi));
+    return (index & 0x80000000) ? 1 : 0;
+}
+
+/*
+ * drop every TLB entry above the wired ones that overlaps [start, end), of any ASID
+ * the entries are read back one by one, as tlbp would only find those of one ASID
+ */
+void tlb_flush_range(unsigned int start, unsigned int end) {
+    unsigned int entryhi, hi, mask;
+    unsigned int index;
+
+    asm volatile("mfc0 %0, $10\n\t" : "=r"(entryhi));
+    for (index = TLB_WIRED; index < TLB_ENTRIES; index++) {
+        asm volatile(
+            "mtc0 %2, $0\n\t"
+            "nop\n\t"
+            "nop\n\t"
+            "tlbr\n\t"
+            "nop\n\t"
+            "nop\n\t"
+            "mfc0 %0, $10\n\t"
+            "mfc0 %1, $5"
+            : "=r"(hi), "=r"(mask)
+            : "r"(index));
+        hi &= 0xffffe000;
+        if (hi >= end || hi + (mask | 0x1fff) < start)
+            continue;
+        asm volatile(
+            "mtc0 $zero, $2\n\t"
+            "mtc0 $zero, $3\n\t"
+            "mtc0 $zero, $5\n\t"
+            "mtc0 %0, $10\n\t"
+            "nop\n\t"
+            "nop\n\t"
+            "tlbwi\n\t"
+            "nop"
+            :
+            : "r"(0x80000000 + (index << 13)));
+    }
+    asm volatile(
+        "mtc0 $zero, $5\n\t"
+        "mtc0 %0, $10\n\t"
+        "nop\n\t"
+        "nop"
+        :
+        : "r"(entryhi));
+}
+
+/*
+ * write a wired entry (index < TLB_WIRED) with its own PageMask
+ * PageMask goes back to 4KB afterwards, the other tlbwi / tlbwr users rely on it
+ */
+void tlb_write_wired(unsigned int index, unsigned int entryhi, unsigned int lo0, unsigned int lo1, unsigned int pagemask) {
+    unsigned int old_hi;
+
+    asm volatile("mfc0 %0, $10\n\t" : "=r"(old_hi));
+    asm volatile(
+        "mtc0 %0, $0\n\t"
+        "mtc0 %1, $10\n\t"
+        "mtc0 %2, $2\n\t"
+        "mtc0 %3, $3\n\t"
+        "mtc0 %4, $5\n\t"
+        "nop\n\t"
+        "nop\n\t"
+        "tlbwi\n\t"
+        "nop\n\t"
+        "mtc0 $zero, $5\n\t"
+        "mtc0 %5, $10\n\t"
+        "nop\n\t"
+        "nop"
+        :
+        : "r"(index), "r"(entryhi), "r"(lo0), "r"(lo1), "r"(pagemask), "r"(old_hi));
+}
+
+// entries [0, TLB_WIRED) are never picked by tlbwr in the refill handler
+void init_tlb_wired() {
+    unsigned int index;
+
+    for (index = TLB_WIRED_FIRST; index < TLB_WIRED; index++)
+        tlb_write_wired(index, 0x80000000 + (index << 13), 0, 0, PAGEMASK_4K);
+    asm volatile(
+        "mtc0 %0, $6\n\t"
+        "nop"
+        :
+        : "r"(TLB_WIRED));
 }
 
 #pragma GCC pop_options
\ No newline at end of file
@@ -2,6 +2,34 @@
 #define _PAGE__H
 
 void init_pgtable();
+void tlb_flush_page(unsigned int va);
+int tlb_update_page(unsigned int va, unsigned int asid, unsigned int lo0, unsigned int lo1);
+void tlb_flush_asid(unsigned int asid);
+void tlb_flush_range(unsigned int start, unsigned int end);
+void tlb_write_wired(unsigned int index, unsigned int entryhi, unsigned int lo0, unsigned int lo1, unsigned int pagemask);
+void init_tlb_wired();
+
+#define TLB_ENTRIES 32
+// entries [TLB_WIRED_FIRST, TLB_WIRED) hold large page mappings
+#define TLB_WIRED_FIRST 0
+#define TLB_WIRED 8
+
+// PageMask of every page size, one TLB entry maps twice the page size
+#define PAGEMASK_4K 0x0
+#define PAGEMASK_16K 0x6000
+#define PAGEMASK_64K 0x1e000
+#define PAGEMASK_256K 0x7e000
+#define PAGEMASK_1M 0x1fe000
+#define PAGEMASK(PAGE_SIZE) ((((PAGE_SIZE) << 1) - 1) & ~0x1fff)
+
+// EntryLo bits, PFN sits at [29:6]
+#define ENTRYLO_G 0x1
+#define ENTRYLO_V 0x2
+#define ENTRYLO_D 0x4
+#define ENTRYLO_CACHED (3 << 3)
+#define ENTRYLO_UNCACHED (2 << 3)
+#define ENTRYLO_PFN(pa) (((pa) >> 6) & 0x01ffffc0)
+#define ENTRYLO_TO_PA(lo) (((lo)&0x01ffffc0) << 6)
 
 typedef struct {
     unsigned int reserved1 : 12;
@@ -4,6 +4,12 @@
 .extern kernel_sp
 .extern exception_handler
 .extern interrupt_handler
+.extern vmalloc_pgtable
+.extern current_pgd
+.extern tlb_refills
+.extern switch_frame
+.globl switch_ex
+.globl switch_wa
 
 .set noreorder
 .set noat
@@ -11,19 +17,54 @@
 
 exception:
 	#TLB refill
- 	mfc0 $k0, $4
- 	lw $k1, 0($k0)
- 	mtc0 $k1, $2
- 	lw $k1, 4($k0)
- 	mtc0 $k1, $3
- 	lw $k1, 8($k0)
- 	mtc0 $k1, $10
- 	lw $k1, 12($k0)
- 	mtc0 $k1, $5
- 	nop #	CP0 hazard
- 	nop #  	CP0 hazard
- 	tlbwr
- 	eret
+	mfc0 $k0, $8
+	lui $k1, 0xc000
+	sltu $k1, $k0, $k1
+	bne $k1, $zero, refill_user
+	lui $k1, 0xc000
+	#kseg2: the vmalloc window, one EntryLo pair per 8KB in vmalloc_pgtable
+	subu $k0, $k0, $k1
+	srl $k0, $k0, 13
+	sltiu $k1, $k0, 8192 # VMALLOC_SIZE >> 13
+	beq $k1, $zero, refill_invalid
+	sll $k0, $k0, 3
+	la $k1, vmalloc_pgtable
+	j refill_load
+	addu $k0, $k0, $k1
+refill_user:
+	#kuseg: two-level page table of the running task, pgd entry per 4MB, EntryLo pair per 8KB
+	lui $k1, %hi(current_pgd)
+	lw $k1, %lo(current_pgd)($k1)
+	srl $k0, $k0, 22
+	sll $k0, $k0, 2
+	addu $k1, $k1, $k0
+	lw $k1, 0($k1)
+	mfc0 $k0, $8
+	beq $k1, $zero, refill_invalid
+	srl $k0, $k0, 10
+	andi $k0, $k0, 0xff8
+	addu $k0, $k0, $k1
+refill_load:
+	lw $k1, 0($k0)
+	mtc0 $k1, $2
+	lw $k1, 4($k0)
+	j refill_write
+	mtc0 $k1, $3
+refill_invalid:
+	#not mapped, an invalid entry makes it a TLB invalid exception
+	mtc0 $zero, $2
+	mtc0 $zero, $3
+refill_write:
+	#EntryHi already holds the missing VPN2 and the current ASID
+	mtc0 $zero, $5
+	lui $k1, %hi(tlb_refills)
+	lw $k0, %lo(tlb_refills)($k1)
+	addiu $k0, $k0, 1
+	sw $k0, %lo(tlb_refills)($k1)
+	nop #	CP0 hazard
+	nop #  	CP0 hazard
+	tlbwr
+	eret
 
 .org 0x0180
 	lui $k0, 0x8000
@@ -89,6 +130,15 @@ interrupt_save_context:
 	nop
 	addi $sp, $sp, 32
 
+switch_check:
+	#the scheduler left the saved frame of the next task, it becomes the stack to restore from
+	lui $k0, %hi(switch_frame)
+	lw $k1, %lo(switch_frame)($k0)
+	beq $k1, $zero, restore_context
+	nop
+	sw $zero, %lo(switch_frame)($k0)
+	move $sp, $k1
+
 restore_context:
 	lw $a2, 0($sp) # EPC
 	lw $t3, 104($sp) # HI
@@ -175,9 +225,38 @@ exception_save_context:
 	nop
 	addi $sp, $sp, 32
 
-	j restore_context
+	j switch_check
 	nop
 
+# void switch_ex(context *frame), status.EXL must be set
+# restore the task whose registers are saved at frame
+switch_ex:
+	j restore_context
+	move $sp, $a0
+
+# void switch_wa(context *frame, context **save), status.EXL must be set
+# save a frame that resumes as a return from this call into *save, then restore frame
+# only the registers a call preserves are saved
+switch_wa:
+	addiu $sp, $sp, -128
+	sw $s0, 64($sp)
+	sw $s1, 68($sp)
+	sw $s2, 72($sp)
+	sw $s3, 76($sp)
+	sw $s4, 80($sp)
+	sw $s5, 84($sp)
+	sw $s6, 88($sp)
+	sw $s7, 92($sp)
+	sw $gp, 112($sp)
+	sw $fp, 120($sp)
+	sw $ra, 124($sp)
+	sw $ra, 0($sp) # EPC
+	addiu $t0, $sp, 128
+	sw $t0, 116($sp) # SP
+	sw $sp, 0($a1)
+	j restore_context
+	move $sp, $a0
+
 .org 0x1000
 start:
 	lui $sp, 0x8100
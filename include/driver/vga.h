@@ -19,6 +19,7 @@ struct screen_color {
 };
 
 void init_vga();
+void init_vram();
 void kernel_set_cursor();
 void kernel_clear_screen(int row);
 void kernel_scroll_screen();
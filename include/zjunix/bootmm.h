@@ -25,8 +25,8 @@ struct bootmm_info {
 struct bootmm {
     unsigned int phymm;    // the actual physical memory
     unsigned int max_pfn;  // record the max page number
-    unsigned char* s_map;  // map begin place
-    unsigned char* e_map;
+    unsigned int* s_map;  // map begin place, one bit per page
+    unsigned int* e_map;
     unsigned int last_alloc_end;
     unsigned int cnt_infos;  // get number of infos stored in bootmm now
     struct bootmm_info info[MAX_INFO];
@@ -56,6 +56,8 @@ extern unsigned char* find_pages(unsigned int page_cnt, unsigned int s_pfn, unsi
 
 extern unsigned char* bootmm_alloc_pages(unsigned int size, unsigned int type, unsigned int align);
 
+extern void bootmm_free_extents(unsigned int s_pfn, unsigned int e_pfn, void (*fn)(unsigned int, unsigned int));
+
 extern void bootmap_info(unsigned char* msg);
 
 #endif
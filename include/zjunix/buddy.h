@@ -7,37 +7,88 @@
 #define _PAGE_RESERVED (1 << 31)
 #define _PAGE_ALLOCED (1 << 30)
 #define _PAGE_SLAB (1 << 29)
+#define _PAGE_TAIL (1 << 28)  // not the first page of a multi-page slab
 
 /*
  * struct buddy page is one info-set for the buddy group of pages
+ * it is kept at 3 words, as there is one of it for every page frame
  */
 struct page {
-    unsigned int flag;       // the declaration of the usage of this page
-    unsigned int reference;  //
-    struct list_head list;   // double-way list
-    void *virtual;           // default 0x(-1)
-    unsigned int bplevel;    /* the order level of the page
-                              *
-                              * unsigned int sl_objs;
-                              * 		represents the number of objects in current
-                              * if the page is of _PAGE_SLAB, then bplevel is the sl_objs
-                              */
-    unsigned int slabp;      /* if the page is used by slab system,
-                              * then slabp represents the base-addr of free space
-                              */
+    unsigned int flag;  /* [31:24] the declaration of the usage of this page
+                         * [23:8]  reference
+                         * [7:0]   bplevel, the order level of the block this page heads
+                         */
+    union {
+        struct list_head list;  // double-way list, buddy freelists and page caches
+        struct {
+            void *virtual;       // the kmem_cache this page belongs to
+            unsigned int slabp;  // the first free object, 0 if the page is full
+        };                       // if the page is used by slab system
+    };
 };
 
+#define _PAGE_REF_SHIFT 8
+#define _PAGE_REF_MASK 0x00ffff00
+#define _PAGE_BPLEVEL_MASK 0x000000ff
+
 #define PAGE_SHIFT 12
 /*
  * order means the size of the set of pages, e.g. order = 1 -> 2^1
  * pages(consequent) are free In current system, we allow the max order to be
- * 4(2^4 consequent free pages)
+ * 10(2^10 consequent free pages, 4MB)
+ */
+#define MAX_BUDDY_ORDER 10
+
+/*
+ * BUDDY_BITMAP: keep one bit per pair of buddy blocks of each order, the bit is
+ * the XOR of the free state of the two blocks. __free_pages then decides merging
+ * by toggling this bit instead of reading bplevel from the buddy's struct page.
+ * Comment it out to fall back to the bplevel comparison.
+ */
+#define BUDDY_BITMAP
+
+/*
+ * free blocks are grouped by how long their users keep them, so that long-lived
+ * kernel pages do not break up every high order block
+ * @MIGRATE_UNMOVABLE   : task structs, large kmalloc blocks, kernel data
+ * @MIGRATE_RECLAIMABLE : slab pages and the zero pool, their shrinkers give them back
  */
-#define MAX_BUDDY_ORDER 4
+#define MIGRATE_UNMOVABLE 0
+#define MIGRATE_RECLAIMABLE 1
+#define MIGRATE_TYPES 2
+
+// taking a block of at least this order from another type moves its whole max-order block
+#define PAGEBLOCK_CLAIM_ORDER (MAX_BUDDY_ORDER >> 1)
+
+// allocation flags
+#define GFP_KERNEL 0
+#define __GFP_RECLAIMABLE 0x1
+#define __GFP_ZERO 0x2  // the pages come back cleared
 
 struct freelist {
-    unsigned int nr_free;
-    struct list_head free_head;
+    unsigned int nr_free;  // of all migrate types
+    struct list_head free_head[MIGRATE_TYPES];
+    unsigned int *map;  // pair bitmap of this order, unused at MAX_BUDDY_ORDER
+};
+
+/*
+ * cache of hot order-0 pages in front of the freelists
+ * refilled from / drained to buddy PCP_BATCH pages at a time
+ */
+#define PCP_TASK 0
+#define PCP_IRQ 1
+#define PCP_COUNT 2
+#define PCP_HIGH 32
+#define PCP_BATCH 8
+
+// pre-zeroed order-0 pages kept by the idle task for __GFP_ZERO
+#define ZERO_POOL_HIGH 32
+
+struct page_cache {
+    unsigned int count;
+    struct list_head list;
+    unsigned int hit;
+    unsigned int miss;  // times a refill from buddy was needed
 };
 
 struct buddy_sys {
@@ -46,30 +97,68 @@ struct buddy_sys {
     struct page *start_page;
     struct lock_t lock;
     struct freelist freelist[MAX_BUDDY_ORDER + 1];
+    struct page_cache pcp[PCP_COUNT];
+    struct page_cache zero_pool;
+    unsigned int nr_free_pages;  // in the freelists, the page caches are not counted
+    unsigned int wmark_low;      // kswapd is woken below it
+    unsigned int wmark_high;     // and reclaims until it is reached again
 };
 
-#define _is_same_bpgroup(page, bage) (((*(page)).bplevel == (*(bage)).bplevel))
-#define _is_same_bplevel(page, lval) ((*(page)).bplevel == (lval))
-#define set_bplevel(page, lval) ((*(page)).bplevel = (lval))
+// 1/64 and 1/32 of the buddy pages
+#define WMARK_LOW_SHIFT 6
+#define WMARK_HIGH_SHIFT 5
+
+/*
+ * a shrinker gives memory cached by its subsystem back to buddy,
+ * (shrink) returns the number of pages it freed
+ */
+struct shrinker {
+    unsigned int (*shrink)();
+    struct list_head list;
+};
+
+#define get_bplevel(page) ((*(page)).flag & _PAGE_BPLEVEL_MASK)
+#define _is_same_bpgroup(page, bage) (get_bplevel(page) == get_bplevel(bage))
+#define _is_same_bplevel(page, lval) (get_bplevel(page) == ((lval)&_PAGE_BPLEVEL_MASK))
+#define set_bplevel(page, lval) ((*(page)).flag = ((*(page)).flag & ~_PAGE_BPLEVEL_MASK) | ((lval)&_PAGE_BPLEVEL_MASK))
 #define set_flag(page, val) ((*(page)).flag |= (val))
 #define clean_flag(page, val) ((*(page)).flag &= ~(val))
 #define has_flag(page, val) ((*(page)).flag & val)
-#define set_ref(page, val) ((*(page)).reference = (val))
-#define inc_ref(page, val) ((*(page)).reference += (val))
-#define dec_ref(page, val) ((*(page)).reference -= (val))
+#define get_ref(page) (((*(page)).flag & _PAGE_REF_MASK) >> _PAGE_REF_SHIFT)
+#define set_ref(page, val) ((*(page)).flag = ((*(page)).flag & ~_PAGE_REF_MASK) | (((val) << _PAGE_REF_SHIFT) & _PAGE_REF_MASK))
+#define inc_ref(page, val) ((*(page)).flag += ((val) << _PAGE_REF_SHIFT))
+#define dec_ref(page, val) ((*(page)).flag -= ((val) << _PAGE_REF_SHIFT))
 
 extern struct page *pages;
 extern struct buddy_sys buddy;
 
 extern void __free_pages(struct page *page, unsigned int order);
 extern struct page *__alloc_pages(unsigned int order);
+extern struct page *__alloc_pages_gfp(unsigned int order, unsigned int gfp);
 
 extern void free_pages(void *addr, unsigned int order);
 
 extern void *alloc_pages(unsigned int order);
+extern void *alloc_pages_gfp(unsigned int order, unsigned int gfp);
+
+extern unsigned int get_order(unsigned int size);
+
+extern void free_pages_range(unsigned int start_pfn, unsigned int end_pfn);
 
 extern void init_buddy();
 
 extern void buddy_info();
 
+extern void buddy_fraginfo();
+
+extern void buddy_bench();
+
+extern void register_shrinker(struct shrinker *s);
+
+extern unsigned int shrink_all();
+
+extern void kswapd();
+
+extern unsigned int refill_zero_pool();
+
 #endif
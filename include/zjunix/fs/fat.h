@@ -110,6 +110,12 @@ struct fs_info {
 
 unsigned long fs_find(FILE *file);
 
+void fs_lock();
+
+u32 fs_trylock();
+
+void fs_unlock();
+
 unsigned long init_fs();
 
 unsigned long fs_open(FILE *file, unsigned char *filename);
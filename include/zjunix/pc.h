@@ -3,12 +3,12 @@
 
 #include <zjunix/pid.h>
 #include <zjunix/list.h>
+#include <zjunix/vm.h>
 
 #define KERNEL_STACK_SIZE 4096      //内核栈大小
 #define TASK_NAME_LEN 32            //进程名长度
 #define START_TIME_LEN 16           //进程开始时间长度
 #define PRORITY_NUM 32              //优先级等级
-#define PRORITY_BYTES ((PRORITY_NUM + 7) >> 3)  //用于优先级位图 
 // task状态
 #define TASK_UNINIT 0               //未初始化
 #define TASK_READY  1               //就绪
@@ -18,6 +18,7 @@
 // 时间片轮换
 #define MIN_TIMESLICE 1             //最小时间片数量
 #define MAX_TIMESLICE 0xffffffff    //最大时间片
+#define TIMER_CYCLES 10000000       //时钟中断间隔，即一个时间片的count周期数
 
 typedef struct {
     unsigned int epc; // 进程重新开始执行的指令地址
@@ -44,15 +45,16 @@ typedef struct {
     volatile int state; // 进程状态
     unsigned int counter; //进程剩余时间片数
     unsigned char start_time[START_TIME_LEN]; // 创建时间
-    context context; // 进程寄存器信息
+    context * frame; // 进程寄存器现场，保存在其内核栈上，切换进程时只交换该指针
     long static_prority; // 静态优先级
     long dynamic_prority; // 动态优先级
     long sleep_avg; // 平均睡眠时间
-    int is_changed; // 是否改变优先级
+    unsigned int stamp_ticks; // 最近一次进出运行的时间戳：时钟中断次数
+    unsigned int stamp_count; // 最近一次进出运行的时间戳：count寄存器
 
     struct list_head sched; // 用于进程调度
     struct list_head list; // 用于进程链表
-    char* mm; // 进程地址空间结构指针
+    struct mm_struct* mm; // 进程地址空间结构指针，内核线程为0
 } task_struct; // 进程控制块
 
 // 注意：union
@@ -64,7 +66,7 @@ typedef union {
 extern struct list_head tasks;                      //存放所有进程
 extern struct list_head sched[PRORITY_NUM + 1];     //调度链表
 extern task_struct *current_task;                   //当前进程 
-unsigned char pro_map[PRORITY_BYTES];               //优先级位图
+extern unsigned int pro_map;                        //优先级位图，PRORITY_NUM不超过32
 
 // init
 void init_pc_list();
@@ -73,20 +75,20 @@ void init_pc();
 void add_tasks(task_struct * task);
 void add_sched(task_struct * task);
 void add_wait(task_struct * task);
-void add_pro_map(task_struct * task);
 int task_create(char * task_name, long static_prority, void (*entry)(unsigned int argc, void * argv),
                 unsigned int argc, void * argv, pid_t * ret_pid, int is_user);
 void remove_terminal(task_struct * task);
 void remove_tasks(task_struct * task);
 void clear_terminal();
-void update_sleep_avg();
-void update_dynamic_prority();
-void update_pro_map();
+void sched_stamp(task_struct * task);
+void update_sleep_avg(task_struct * task, int is_run);
+void update_dynamic_prority(task_struct * task);
 task_struct * find_in_pro_map();
 task_struct * find_next_task();
-static void copy_context(context* src, context* dest);
 void activate_mm(task_struct * task);
 void pc_schedule(unsigned int status, unsigned int cause, context* pt_context);
+void pc_idle();
+void tick_program();
 int print_proc();
 void print_task_struct();
 task_struct * find_in_tasks(pid_t pid);
@@ -99,4 +101,11 @@ task_struct * wait_check(pid_t pid);
 void task_exit();
 void wakeup_parent();
 void wait_pid(pid_t pid);
+void wake_up_process(task_struct * task);
+unsigned int schedule_timeout(unsigned int timeout);
+void msleep(unsigned int ms);
+void switch_bench();
+// start.s
+void switch_ex(context * frame);                    //加载寄存器现场frame
+void switch_wa(context * frame, context ** save);   //现场保存到*save后加载frame
 #endif  // !_ZJUNIX_PC_H
\ No newline at end of file
@@ -9,12 +9,12 @@
 #define SLAB_USED 0xff
 
 /*
- * slab_head makes the allocation accessible from end_ptr to the end of the page
- * @end_ptr : points to the head of the rest of the page
+ * slab_head sits at the beginning of every slab page, objects follow it
+ * @list    : chains the page in kmem_cache_node, struct page has no room for it
  * @nr_objs : keeps the numbers of memory segments that has been allocated
  */
 struct slab_head {
-    void *end_ptr;
+    struct list_head list;
     unsigned int nr_objs;
 };
 
@@ -22,17 +22,34 @@ struct slab_head {
  * slab pages is chained in this struct
  * @partial keeps the list of un-totally-allocated pages
  * @full keeps the list of totally-allocated pages
+ * @empty keeps at most SLAB_MAX_EMPTY formatted pages with no object allocated
  */
 struct kmem_cache_node {
     struct list_head partial;
     struct list_head full;
+    struct list_head empty;
+    unsigned int nr_empty;
 };
 
+#define SLAB_MAX_EMPTY 2
+
+/*
+ * SLAB_LLSC: pop and push the active freelist with ll/sc, leaving interrupts on.
+ * This needs a core that implements ll/sc and clears LLbit on eret, so that an
+ * interrupt between ll and sc makes sc fail. Comment it out on a core without
+ * them, the freelist is then updated with interrupts off.
+ */
+#define SLAB_LLSC
+
+// kmem_cache_create() flags
+#define SLAB_HWCACHE_ALIGN 0x1  // start objects on a cache line, small objects share one
+
 /*
  * current being allocated page unit
+ * kmalloc/kfree only touch (freeobj) while it is not empty or the freed object is in (page)
  */
 struct kmem_cache_cpu {
-    void **freeobj;  // points to the free-space head addr inside current page
+    void **freeobj;  // the active freelist: the free objects of (page), taken off the page's own chain
     struct page *page;
 };
 
@@ -40,14 +57,34 @@ struct kmem_cache {
     unsigned int size;
     unsigned int objsize;
     unsigned int offset;
+    unsigned int align;
+    unsigned int order;    // a slab is 2^order pages
+    unsigned int color;       // number of starting offsets new slabs rotate through
+    unsigned int color_off;   // distance between two of them
+    unsigned int color_next;  // the one of the next new slab
+    void (*ctor)(void *);  // runs on every object of a new slab page
     struct kmem_cache_node node;
     struct kmem_cache_cpu cpu;
+    struct list_head list;  // chained in slab_caches
     unsigned char name[16];
 };
 
 // extern struct kmem_cache kmalloc_caches[PAGE_SHIFT];
 extern void init_slab();
 extern void *kmalloc(unsigned int size);
+extern void *kzalloc(unsigned int size);
 extern void kfree(void *obj);
+extern void slab_info();
+
+extern struct kmem_cache *kmem_cache_create(char *name, unsigned int size, unsigned int align, unsigned int flags,
+                                            void (*ctor)(void *));
+extern void *kmem_cache_alloc(struct kmem_cache *cache);
+extern void kmem_cache_free(struct kmem_cache *cache, void *obj);
+extern unsigned int kmem_cache_shrink(struct kmem_cache *cache);
+extern unsigned int slab_shrink();
+
+extern unsigned int kmem_cache_alloc_bulk(struct kmem_cache *cache, unsigned int nr, void **p);
+extern unsigned int kmalloc_bulk(unsigned int size, unsigned int nr, void **p);
+extern void kfree_bulk(unsigned int nr, void **p);
 
 #endif
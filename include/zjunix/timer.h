@@ -0,0 +1,32 @@
+#ifndef _ZJUNIX_TIMER_H
+#define _ZJUNIX_TIMER_H
+
+#include <zjunix/list.h>
+
+// CP0 count runs at the 100MHz of the wall clock counter (cp0 $9 sel 6), see get_time_string()
+#define COUNT_PER_MS 100000
+
+/*
+ * a kernel timer, (function) is called with (data) from the timer interrupt
+ * once (expires), in jiffies, is reached; a jiffy is one millisecond
+ */
+struct timer_list {
+    struct list_head list;  // empty while the timer is not pending
+    unsigned int expires;
+    void (*function)(unsigned int data);
+    unsigned int data;
+};
+
+// milliseconds since init_timers(), brought up to date by update_jiffies()
+extern unsigned int jiffies;
+
+extern void init_timers();
+extern void update_jiffies();
+extern void init_timer(struct timer_list *timer);
+extern void add_timer(struct timer_list *timer);
+extern int del_timer(struct timer_list *timer);
+extern unsigned int timer_pending(struct timer_list *timer);
+extern unsigned int run_timers();
+extern int next_timer_count(unsigned int *count);
+
+#endif  // !_ZJUNIX_TIMER_H
@@ -0,0 +1,79 @@
+#ifndef _ZJUNIX_VM_H
+#define _ZJUNIX_VM_H
+
+#include <zjunix/list.h>
+
+/*
+ * the user address space of a task, its TLB entries are tagged with (asid)
+ * so the entries of different tasks stay in the TLB together
+ * kuseg is mapped by a two-level page table:
+ *   pgd : PTRS_PER_PGD kseg0 pointers to pte pages, 0 if none, one per 4MB
+ *   pte : one page of EntryLo0/EntryLo1 pairs, one pair per 8KB
+ * so the refill handler loads both halves of a pair with two loads
+ */
+#define PGDIR_SHIFT 22
+#define PTRS_PER_PGD 512  // kuseg is 2GB
+#define PTRS_PER_PTE 1024
+#define USER_SPACE_END 0x80000000
+
+#define pgd_index(va) ((va) >> PGDIR_SHIFT)
+#define pte_index(va) (((va) >> 12) & (PTRS_PER_PTE - 1))
+
+// software bit of a pte, EntryLo ignores it: the page is shared, copy it on the first write
+#define PTE_COW 0x80000000
+
+struct vm_file;  // an open file that regions are paged in from, see vm_file_open()
+
+/*
+ * a range of kuseg that is filled page by page on its first touch
+ * the first (filesz) bytes come from (file) at (offset), the rest is zero filled
+ */
+struct vm_region {
+    struct list_head list;
+    unsigned int start;
+    unsigned int end;
+    unsigned int flags;     // EntryLo bits of its pages, ENTRYLO_D if it is writable
+    struct vm_file *file;   // 0 for anonymous memory
+    unsigned int offset;
+    unsigned int filesz;
+};
+
+struct mm_struct {
+    unsigned int **pgd;
+    unsigned int asid;
+    struct list_head regions;
+};
+
+// the pgd of the running task, read by the TLB refill handler, an empty one for kernel tasks
+extern unsigned int **current_pgd;
+
+/*
+ * the address space page faults are resolved in, 0 for kernel tasks
+ * a TLB miss with status.EXL set does not go through the refill handler and can not be
+ * resumed, so exception handlers and code running with EXL set must not touch kuseg,
+ * they read user memory through user_kva()
+ */
+extern struct mm_struct *current_mm;
+
+// TLB refills since boot, counted by the refill handler
+extern unsigned int tlb_refills;
+// page faults since boot, both demand loads and copy-on-write
+extern unsigned int page_faults;
+
+extern void init_vm();
+
+extern struct mm_struct *mm_create(unsigned int asid);
+extern void mm_delete(struct mm_struct *mm);
+extern int mm_map_page(struct mm_struct *mm, unsigned int va, unsigned int pa, unsigned int flags);
+extern void mm_switch(struct mm_struct *mm, unsigned int asid);
+extern struct mm_struct *mm_dup(struct mm_struct *mm, unsigned int asid);
+extern int mm_add_region(struct mm_struct *mm, unsigned int start, unsigned int size, unsigned int flags,
+                         struct vm_file *file, unsigned int offset, unsigned int filesz);
+extern struct vm_file *vm_file_open(char *filename);
+extern unsigned int vm_file_size(struct vm_file *file);
+extern unsigned int vm_file_read(struct vm_file *file, unsigned int offset, void *buf, unsigned int size);
+extern void vm_file_put(struct vm_file *file);
+extern void *user_kva(unsigned int va);
+extern void cow_test();
+
+#endif  // !_ZJUNIX_VM_H
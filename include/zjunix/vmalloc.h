@@ -0,0 +1,42 @@
+#ifndef _ZJUNIX_VMALLOC_H
+#define _ZJUNIX_VMALLOC_H
+
+#include <zjunix/list.h>
+
+/*
+ * the vmalloc window is the start of kseg2, mapped by the TLB refill handler in start.s
+ * from vmalloc_pgtable, which holds one EntryLo0/EntryLo1 pair for every 8KB of it
+ * a TLB miss with status.EXL set does not go through the refill handler,
+ * so vmalloc memory must not be touched by interrupt handlers
+ */
+#define VMALLOC_START 0xc0000000
+#define VMALLOC_SIZE (64 * 1024 * 1024)  // start.s checks against VMALLOC_SIZE >> 13
+#define VMALLOC_END (VMALLOC_START + VMALLOC_SIZE)
+
+// one vmalloc'ed area, followed by an unmapped guard page
+struct vm_area {
+    struct list_head list;
+    unsigned int addr;
+    unsigned int size;  // without the guard page
+};
+
+/*
+ * large page mappings sit right above the vmalloc window, in wired TLB entries
+ * that map two pages of up to 1MB each, so streaming over them takes no refill
+ * wired entry i owns the slot at LARGEMAP_START + i * LARGEMAP_SLOT
+ */
+#define LARGE_PAGE_MAX (1024 * 1024)
+#define LARGEMAP_SLOT (LARGE_PAGE_MAX << 1)
+#define LARGEMAP_START VMALLOC_END
+
+extern unsigned int vmalloc_pgtable[VMALLOC_SIZE >> 12];
+
+extern void init_vmalloc();
+extern void *vmalloc(unsigned int size);
+extern void vfree(void *addr);
+extern void vmalloc_info();
+extern void *vmap_large(unsigned int pa, unsigned int size, unsigned int flags);
+extern void vunmap_large(void *addr);
+extern void tlb_bench();
+
+#endif  // !_ZJUNIX_VMALLOC_H
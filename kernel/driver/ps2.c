@@ -1,6 +1,7 @@
 #include "ps2.h"
 #include <driver/vga.h>
 #include <intr.h>
+#include <zjunix/pc.h>
 
 #pragma GCC push_options
 #pragma GCC optimize("O0")
@@ -15,6 +16,9 @@ static volatile unsigned int keyboard_state = 0;
 #define CTRL_MASK 16
 #define ALT_MASK 32
 
+// keys come in by interrupt into buffer, kernel_getchar() looks at it this often
+#define PS2_POLL_MS 10
+
 static unsigned int buffer[32];
 static unsigned int ready[32];
 static volatile int buffer_wptr = 0;
@@ -224,17 +228,15 @@ int kernel_scantoascii(int key) {
         return (int)scantoascii_lowercase[key];
 }
 
-void sleep(int cycle) {
-    while (cycle--)
-        ;
-}
-
 int kernel_getchar() {
     int key;
-    do {
+    while (1) {
         key = kernel_scantoascii(kernel_getkey());
-        sleep(1000);
-    } while (key == -1);
+        if (key != -1)
+            break;
+        // nothing typed, the caller sleeps until the next poll instead of spinning
+        msleep(PS2_POLL_MS);
+    }
 #ifdef PS2_DEBUG
     print_curr_char(key);
 #endif  // ! PS2_DEBUG
@@ -1,6 +1,8 @@
 #include "vga.h"
 #include <arch.h>
+#include <page.h>
 #include <zjunix/utils.h>
+#include <zjunix/vmalloc.h>
 
 const int VGA_CHAR_MAX_ROW = 32;
 const int VGA_CHAR_MAX_COL = 128;
@@ -21,6 +23,14 @@ void init_vga() {
     kernel_set_cursor();
 }
 
+// map the graphic VRAM with large pages in a wired entry, after init_vmalloc()
+// it stays in kseg1 if no wired entry is left
+void init_vram() {
+    void *vram = vmap_large(GRAPHIC_VRAM_PA, GRAPHIC_VRAM_SIZE, ENTRYLO_UNCACHED | ENTRYLO_D);
+    if (vram)
+        GRAPHIC_VRAM = (unsigned int *)vram;
+}
+
 void kernel_clear_screen(int scope) {
     unsigned int w = 0x000fff00;
     scope &= 31;
@@ -11,7 +11,7 @@ extern u32 dir_data_clock_head;
 extern struct fs_info fat_info;
 
 /* open directory */
-u32 fs_open_dir(FS_FAT_DIR *dir, u8 *filename) {
+static u32 __fs_open_dir(FS_FAT_DIR *dir, u8 *filename) {
     u32 index;
     u32 i;
 
@@ -59,8 +59,17 @@ fs_open_dir_err:
     return 1;
 }
 
+u32 fs_open_dir(FS_FAT_DIR *dir, u8 *filename) {
+    u32 ret;
+
+    fs_lock();
+    ret = __fs_open_dir(dir, filename);
+    fs_unlock();
+    return ret;
+}
+
 /* read dir */
-u32 fs_read_dir(FS_FAT_DIR *dir, u8 *buf) {
+static u32 __fs_read_dir(FS_FAT_DIR *dir, u8 *buf) {
     u32 sec;
     u32 i;
     u32 index;
@@ -122,4 +131,13 @@ after_fs_read_dir_nomore:
     return 0xffffffff;
 fs_read_dir_err:
     return 1;
+}
+
+u32 fs_read_dir(FS_FAT_DIR *dir, u8 *buf) {
+    u32 ret;
+
+    fs_lock();
+    ret = __fs_read_dir(dir, buf);
+    fs_unlock();
+    return ret;
 }
\ No newline at end of file
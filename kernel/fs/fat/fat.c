@@ -1,10 +1,12 @@
 #include "fat.h"
 #include <driver/vga.h>
+#include <intr.h>
 #include <zjunix/log.h>
+#include <zjunix/pc.h>
+#include <zjunix/slab.h>
 #include "utils.h"
 
 #ifdef FS_DEBUG
-#include <intr.h>
 #include <zjunix/log.h>
 #include "debug.h"
 #endif  // ! FS_DEBUG
@@ -14,7 +16,6 @@ u32 fat_clock_head = 0;
 BUF_512 fat_buf[FAT_BUF_NUM];
 
 u8 filename11[13];
-u8 new_alloc_empty[PAGE_SIZE];
 
 #define DIR_DATA_BUF_NUM 4
 BUF_512 dir_data_buf[DIR_DATA_BUF_NUM];
@@ -22,6 +23,57 @@ u32 dir_data_clock_head = 0;
 
 struct fs_info fat_info;
 
+/*
+ * the fs calls of different tasks must not interleave, the SD transfers and the global
+ * buffers are shared, and the page fault handler reads files in the middle of any task
+ * the task holding the fs may call in again, e.g. fs_cat() through fs_open()
+ */
+static task_struct *fs_owner = 0;
+static u32 fs_depth = 0;
+
+// wait with interrupts on until no other task is in the fs, a tick runs the holder meanwhile
+void fs_lock() {
+    u32 old_ie;
+
+    while (1) {
+        old_ie = disable_interrupts();
+        if (!fs_depth || fs_owner == current_task) {
+            fs_owner = current_task;
+            ++fs_depth;
+            if (old_ie)
+                enable_interrupts();
+            return;
+        }
+        if (old_ie)
+            enable_interrupts();
+    }
+}
+
+// take the fs without waiting, for the page fault handler, return 1 if another task holds it
+u32 fs_trylock() {
+    u32 old_ie;
+    u32 busy;
+
+    old_ie = disable_interrupts();
+    busy = fs_depth && fs_owner != current_task;
+    if (!busy) {
+        fs_owner = current_task;
+        ++fs_depth;
+    }
+    if (old_ie)
+        enable_interrupts();
+    return busy;
+}
+
+void fs_unlock() {
+    u32 old_ie;
+
+    old_ie = disable_interrupts();
+    --fs_depth;
+    if (old_ie)
+        enable_interrupts();
+}
+
 u32 init_fat_info() {
     u8 meta_buf[512];
 
@@ -308,7 +360,7 @@ fs_find_err:
 }
 
 /* Open: just do initializing & fs_find */
-u32 fs_open(FILE *file, u8 *filename) {
+static u32 __fs_open(FILE *file, u8 *filename) {
     u32 i;
 
     /* Local buffer initialize */
@@ -337,8 +389,17 @@ u32 fs_open(FILE *file, u8 *filename) {
 fs_open_err:
     return 1;
 }
+
+u32 fs_open(FILE *file, u8 *filename) {
+    u32 ret;
+
+    fs_lock();
+    ret = __fs_open(file, filename);
+    fs_unlock();
+    return ret;
+}
 /* fflush, write global buffers to sd */
-u32 fs_fflush() {
+static u32 __fs_fflush() {
     u32 i;
 
     // FSInfo shoud add base_addr
@@ -362,8 +423,17 @@ fs_fflush_err:
     return 1;
 }
 
+u32 fs_fflush() {
+    u32 ret;
+
+    fs_lock();
+    ret = __fs_fflush();
+    fs_unlock();
+    return ret;
+}
+
 /* Close: write all buf in memory to SD */
-u32 fs_close(FILE *file) {
+static u32 __fs_close(FILE *file) {
     u32 i;
     u32 index;
 
@@ -390,8 +460,17 @@ fs_close_err:
     return 1;
 }
 
+u32 fs_close(FILE *file) {
+    u32 ret;
+
+    fs_lock();
+    ret = __fs_close(file);
+    fs_unlock();
+    return ret;
+}
+
 /* Read from file */
-u32 fs_read(FILE *file, u8 *buf, u32 count) {
+static u32 __fs_read(FILE *file, u8 *buf, u32 count) {
     u32 start_clus, start_byte;
     u32 end_clus, end_byte;
     u32 filesize = file->entry.attr.size;
@@ -475,6 +554,15 @@ fs_read_err:
     return 0xFFFFFFFF;
 }
 
+u32 fs_read(FILE *file, u8 *buf, u32 count) {
+    u32 ret;
+
+    fs_lock();
+    ret = __fs_read(file, buf, count);
+    fs_unlock();
+    return ret;
+}
+
 /* Find a free data cluster */
 u32 fs_next_free(u32 start, u32 *next_free) {
     u32 clus;
@@ -501,6 +589,7 @@ fs_next_free_err:
 u32 fs_alloc(u32 *new_alloc) {
     u32 clus;
     u32 next_free;
+    u8 *empty;
 
     clus = get_u32(fat_info.fat_fs_info + 492) + 1;
 
@@ -529,9 +618,15 @@ u32 fs_alloc(u32 *new_alloc) {
 
     *new_alloc = clus;
 
-    /* Erase new allocated cluster */
-    if (write_block(new_alloc_empty, fs_dataclus2sec(clus), fat_info.BPB.attr.sectors_per_cluster) == 1)
+    /* Erase new allocated cluster, with a page the idle task has cleared already */
+    empty = (u8 *)kzalloc(PAGE_SIZE);
+    if (empty == 0)
         goto fs_alloc_err;
+    if (write_block(empty, fs_dataclus2sec(clus), fat_info.BPB.attr.sectors_per_cluster) == 1) {
+        kfree(empty);
+        goto fs_alloc_err;
+    }
+    kfree(empty);
 
     return 0;
 fs_alloc_err:
@@ -539,7 +634,7 @@ fs_alloc_err:
 }
 
 /* Write to file */
-u32 fs_write(FILE *file, const u8 *buf, u32 count) {
+static u32 __fs_write(FILE *file, const u8 *buf, u32 count) {
     /* If write 0 bytes */
     if (count == 0) {
         return 0;
@@ -641,6 +736,15 @@ fs_write_err:
     return 0xFFFFFFFF;
 }
 
+u32 fs_write(FILE *file, const u8 *buf, u32 count) {
+    u32 ret;
+
+    fs_lock();
+    ret = __fs_write(file, buf, count);
+    fs_unlock();
+    return ret;
+}
+
 /* lseek */
 void fs_lseek(FILE *file, u32 new_loc) {
     u32 filesize = file->entry.attr.size;
@@ -790,10 +894,19 @@ fs_creat_err:
     return 1;
 }
 
-u32 fs_create(u8 *filename) {
+static u32 __fs_create(u8 *filename) {
     return fs_create_with_attr(filename, 0x20);
 }
 
+u32 fs_create(u8 *filename) {
+    u32 ret;
+
+    fs_lock();
+    ret = __fs_create(filename);
+    fs_unlock();
+    return ret;
+}
+
 void get_filename(u8 *entry, u8 *buf) {
     u32 i;
     u32 l1 = 0, l2 = 8;
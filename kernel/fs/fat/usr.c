@@ -8,7 +8,7 @@ u8 mk_dir_buf[32];
 FILE file_create;
 
 /* remove directory entry */
-u32 fs_rm(u8 *filename) {
+static u32 __fs_rm(u8 *filename) {
     u32 clus;
     u32 next_clus;
     FILE mk_dir;
@@ -40,8 +40,17 @@ fs_rm_err:
     return 1;
 }
 
+u32 fs_rm(u8 *filename) {
+    u32 ret;
+
+    fs_lock();
+    ret = __fs_rm(filename);
+    fs_unlock();
+    return ret;
+}
+
 /* move directory entry */
-u32 fs_mv(u8 *src, u8 *dest) {
+static u32 __fs_mv(u8 *src, u8 *dest) {
     u32 i;
     FILE mk_dir;
     u8 filename11[13];
@@ -83,8 +92,17 @@ fs_mv_err:
     return 1;
 }
 
+u32 fs_mv(u8 *src, u8 *dest) {
+    u32 ret;
+
+    fs_lock();
+    ret = __fs_mv(src, dest);
+    fs_unlock();
+    return ret;
+}
+
 /* mkdir, create a new file and write . and .. */
-u32 fs_mkdir(u8 *filename) {
+static u32 __fs_mkdir(u8 *filename) {
     u32 i;
     FILE mk_dir;
     FILE file_creat;
@@ -143,7 +161,16 @@ fs_mkdir_err:
     return 1;
 }
 
-u32 fs_cat(u8 *path) {
+u32 fs_mkdir(u8 *filename) {
+    u32 ret;
+
+    fs_lock();
+    ret = __fs_mkdir(filename);
+    fs_unlock();
+    return ret;
+}
+
+static u32 __fs_cat(u8 *path) {
     u8 filename[12];
     FILE cat_file;
 
@@ -162,4 +189,13 @@ u32 fs_cat(u8 *path) {
     fs_close(&cat_file);
     kfree(buf);
     return 0;
+}
+
+u32 fs_cat(u8 *path) {
+    u32 ret;
+
+    fs_lock();
+    ret = __fs_cat(path);
+    fs_unlock();
+    return ret;
 }
\ No newline at end of file
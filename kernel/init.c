@@ -12,8 +12,21 @@
 #include <zjunix/slab.h>
 #include <zjunix/syscall.h>
 #include <zjunix/time.h>
+#include <zjunix/vm.h>
+#include <zjunix/vmalloc.h>
 #include "../usr/ps.h"
 
+// CP0 count of the last boot phase, count runs from reset and the timer never resets it
+unsigned int boot_stamp;
+
+// cycles spent since the last boot phase
+unsigned int boot_phase_cycles() {
+    unsigned int now = get_cp0_count();
+    unsigned int cycles = now - boot_stamp;
+    boot_stamp = now;
+    return cycles;
+}
+
 void machine_info() {
     int row;
     int col;
@@ -36,6 +49,10 @@ void create_startup_process() {
     log(LOG_OK, "Shell init");
     pc_create(2, system_time_proc, (unsigned int)kmalloc(4096) + 4096, init_gp, "time");
     log(LOG_OK, "Timer init");
+    if (task_create("kswapd", 3, (void *)kswapd, 0, 0, 0, 0))
+        log(LOG_FAIL, "Kswapd init");
+    else
+        log(LOG_OK, "Kswapd init");
 }
 #pragma GCC pop_options
 
@@ -49,18 +66,24 @@ void init_kernel() {
     init_vga();
     init_ps2();
     // Memory management
-    log(LOG_START, "Memory Modules.");
+    log(LOG_START, "Memory Modules. (%d cycles from reset)", boot_phase_cycles());
     init_bootmm();
-    log(LOG_OK, "Bootmem.");
+    log(LOG_OK, "Bootmem. (%d cycles)", boot_phase_cycles());
     init_buddy();
-    log(LOG_OK, "Buddy.");
+    log(LOG_OK, "Buddy. (%d cycles)", boot_phase_cycles());
     init_slab();
-    log(LOG_OK, "Slab.");
+    log(LOG_OK, "Slab. (%d cycles)", boot_phase_cycles());
+    init_vmalloc();
+    log(LOG_OK, "Vmalloc.");
+    init_vram();
+    log(LOG_OK, "Graphic VRAM at %x.", (unsigned int)GRAPHIC_VRAM);
+    init_vm();
+    log(LOG_OK, "Page fault handler.");
     log(LOG_END, "Memory Modules.");
     // File system
     log(LOG_START, "File System.");
     init_fs();
-    log(LOG_END, "File System.");
+    log(LOG_END, "File System. (%d cycles)", boot_phase_cycles());
     // System call
     log(LOG_START, "System Calls.");
     init_syscall();
@@ -69,7 +92,8 @@ void init_kernel() {
     log(LOG_START, "Process Control Module.");
     init_pc();
     create_startup_process();
-    log(LOG_END, "Process Control Module.");
+    log(LOG_END, "Process Control Module. (%d cycles)", boot_phase_cycles());
+    log(LOG_OK, "Boot. (%d cycles from reset)", boot_stamp);
     // Interrupts
     log(LOG_START, "Enable Interrupts.");
     init_interrupts();
@@ -77,7 +101,10 @@ void init_kernel() {
     // Init finished
     machine_info();
     *GPIO_SEG = 0x11223344;
-    // Enter shell
-    while (1)
-        ;
+    // Enter shell, this context goes on as the idle task and clears pages in the background,
+    // then waits for an interrupt with the periodic tick stopped if nothing is runnable
+    while (1) {
+        if (!refill_zero_pool())
+            pc_idle();
+    }
 }
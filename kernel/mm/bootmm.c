@@ -16,7 +16,7 @@ void set_mminfo(struct bootmm_info *info, unsigned int start, unsigned int end,
     info->end = end;
     info->type = type;
 }
-unsigned char bootmmmap[MACHINE_MMSIZE >> PAGE_SHIFT];
+unsigned int bootmmmap[(MACHINE_MMSIZE >> PAGE_SHIFT) >> 5];
 /*
 * return value list:
 *		0 -> insert_mminfo failed
@@ -112,23 +112,31 @@ void remove_mminfo(struct bootmm *mm, unsigned int index) {
 }
 
 void init_bootmm() {
-    unsigned int index;
-    unsigned char *t_map;
     unsigned int end;
     end = 16 * 1024 * 1024;
     kernel_memset(&bmm, 0, sizeof(bmm));
     bmm.phymm = get_phymm_size();
     bmm.max_pfn = bmm.phymm >> PAGE_SHIFT;
     bmm.s_map = bootmmmap;
-    bmm.e_map = bootmmmap + sizeof(bootmmmap);
+    bmm.e_map = bootmmmap + sizeof(bootmmmap) / sizeof(bootmmmap[0]);
     bmm.cnt_infos = 0;
-    kernel_memset(bmm.s_map, PAGE_FREE, sizeof(bootmmmap));
+    kernel_memset_word(bmm.s_map, 0, sizeof(bootmmmap) >> 2);
     insert_mminfo(&bmm, 0, (unsigned int)(end - 1), _MM_KERNEL);
     bmm.last_alloc_end = (((unsigned int)(end) >> PAGE_SHIFT) - 1);
+    set_maps(0, end >> PAGE_SHIFT, PAGE_USED);
+}
 
-    for (index = 0; index<end>> PAGE_SHIFT; index++) {
-        bmm.s_map[index] = PAGE_USED;
-    }
+/*
+ * one bit per page, 1 for used, the first page of a word is its most significant bit,
+ * so that clz gives the first used page of a word and clz of its inverse the first free one
+ */
+#define MAP_BITS 32
+#define MAP_SHIFT 5
+
+static unsigned int clz(unsigned int x) {
+    unsigned int n;
+    asm volatile("clz %0, %1" : "=r"(n) : "r"(x));
+    return n;
 }
 
 /*
@@ -138,11 +146,43 @@ void init_bootmm() {
  * @param value	: the value to be set
  */
 void set_maps(unsigned int s_pfn, unsigned int cnt, unsigned char value) {
+    unsigned int *word = bmm.s_map + (s_pfn >> MAP_SHIFT);
+    unsigned int head = s_pfn & (MAP_BITS - 1);
+    unsigned int n, mask;
+
     while (cnt) {
-        bmm.s_map[s_pfn] = (unsigned char)value;
-        --cnt;
-        ++s_pfn;
+        n = MAP_BITS - head;
+        if (n > cnt)
+            n = cnt;
+        mask = 0xffffffff >> head;
+        if (head + n < MAP_BITS)
+            mask &= ~(0xffffffff >> (head + n));
+        if (value == PAGE_USED)
+            *word |= mask;
+        else
+            *word &= ~mask;
+        cnt -= n;
+        head = 0;
+        ++word;
+    }
+}
+
+// the first page in [pfn, e_pfn) that is used (used = 1) or free (used = 0), e_pfn if none
+static unsigned int find_next_page(unsigned int pfn, unsigned int e_pfn, unsigned int used) {
+    unsigned int word;
+
+    while (pfn < e_pfn) {
+        word = bmm.s_map[pfn >> MAP_SHIFT];
+        if (!used)
+            word = ~word;
+        word &= 0xffffffff >> (pfn & (MAP_BITS - 1));
+        if (word) {
+            pfn = (pfn & ~(MAP_BITS - 1)) + clz(word);
+            break;
+        }
+        pfn = (pfn & ~(MAP_BITS - 1)) + MAP_BITS;
     }
+    return (pfn < e_pfn) ? pfn : e_pfn;
 }
 
 /*
@@ -154,42 +194,44 @@ void set_maps(unsigned int s_pfn, unsigned int cnt, unsigned char value) {
  */
 unsigned char *find_pages(unsigned int page_cnt, unsigned int s_pfn, unsigned int e_pfn, unsigned int align_pfn) {
     unsigned int index, tmp;
-    unsigned int cnt;
 
-    s_pfn += (align_pfn - 1);
-    s_pfn &= ~(align_pfn - 1);
+    if (!align_pfn)
+        align_pfn = 1;
 
-    for (index = s_pfn; index < e_pfn;) {
-        if (bmm.s_map[index] == PAGE_USED) {
-            ++index;
-            continue;
-        }
-
-        cnt = page_cnt;
-        tmp = index;
-        while (cnt) {
-            if (tmp >= e_pfn)
-                return 0;
-            // reaching end, but allocate request still cannot be satisfied
+    index = s_pfn;
+    while (1) {
+        // skip the used pages a word at a time, then check the run is long enough
+        index = find_next_page(index, e_pfn, 0);
+        index += (align_pfn - 1);
+        index &= ~(align_pfn - 1);
+        if (index + page_cnt > e_pfn)
+            return 0;
 
-            if (bmm.s_map[tmp] == PAGE_FREE) {
-                tmp++;  // find next possible free page
-                cnt--;
-            }
-            if (bmm.s_map[tmp] == PAGE_USED) {
-                break;
-            }
-        }
-        if (cnt == 0) {  // cnt = 0 indicates that the specified page-sequence found
+        tmp = find_next_page(index, index + page_cnt, 1);
+        if (tmp == index + page_cnt) {
             bmm.last_alloc_end = tmp - 1;
             set_maps(index, page_cnt, PAGE_USED);
             return (unsigned char *)(index << PAGE_SHIFT);
-        } else {
-            index = tmp + align_pfn;  // there will be no possible memory space
-                                      // to be allocated before tmp
         }
+        index = tmp;  // there will be no possible memory space to be allocated before tmp
+    }
+}
+
+/*
+ * call (fn) on every extent [start, end) of free pages in [s_pfn, e_pfn),
+ * so that buddy takes them without looking at the pages one by one
+ */
+void bootmm_free_extents(unsigned int s_pfn, unsigned int e_pfn, void (*fn)(unsigned int, unsigned int)) {
+    unsigned int end;
+
+    while (s_pfn < e_pfn) {
+        s_pfn = find_next_page(s_pfn, e_pfn, 0);
+        if (s_pfn >= e_pfn)
+            break;
+        end = find_next_page(s_pfn, e_pfn, 1);
+        fn(s_pfn, end);
+        s_pfn = end;
     }
-    return 0;
 }
 
 unsigned char *bootmm_alloc_pages(unsigned int size, unsigned int type, unsigned int align) {
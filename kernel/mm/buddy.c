@@ -1,8 +1,11 @@
+#include <arch.h>
 #include <driver/vga.h>
+#include <intr.h>
 #include <zjunix/bootmm.h>
 #include <zjunix/buddy.h>
 #include <zjunix/list.h>
 #include <zjunix/lock.h>
+#include <zjunix/pc.h>
 #include <zjunix/utils.h>
 
 unsigned int kernel_start_pfn, kernel_end_pfn;
@@ -10,6 +13,23 @@ unsigned int kernel_start_pfn, kernel_end_pfn;
 struct page *pages;
 struct buddy_sys buddy;
 
+// every registered struct shrinker, called in registration order
+static struct list_head shrinkers;
+// set when free pages drop below wmark_low, cleared by kswapd once they are above wmark_high
+static volatile unsigned int kswapd_wake;
+static task_struct *kswapd_task;
+static unsigned int kswapd_runs;
+
+// migrate type of every max-order block, free blocks go to the freelist of their block's type
+static unsigned char pageblock_type[MACHINE_MMSIZE >> (PAGE_SHIFT + MAX_BUDDY_ORDER)];
+#define get_pageblock_type(page) (pageblock_type[((page) - pages) >> MAX_BUDDY_ORDER])
+#define set_pageblock_type(page, type) (pageblock_type[((page) - pages) >> MAX_BUDDY_ORDER] = (type))
+
+static void __buddy_free(struct page *pbpage, unsigned int bplevel);
+static unsigned int zero_pool_shrink();
+
+static struct shrinker zero_pool_shrinker = {zero_pool_shrink};
+
 // void set_bplevel(struct page* bp, unsigned int bplevel)
 //{
 //	bp->bplevel = bplevel;
@@ -23,26 +43,103 @@ void buddy_info() {
     for (index = 0; index <= MAX_BUDDY_ORDER; ++index) {
         kernel_printf("\t(%x)# : %x frees\n", index, buddy.freelist[index].nr_free);
     }
+    kernel_printf("\ttask page cache : %x pages, %x hits, %x misses\n", buddy.pcp[PCP_TASK].count, buddy.pcp[PCP_TASK].hit,
+                  buddy.pcp[PCP_TASK].miss);
+    kernel_printf("\tintr page cache : %x pages, %x hits, %x misses\n", buddy.pcp[PCP_IRQ].count, buddy.pcp[PCP_IRQ].hit,
+                  buddy.pcp[PCP_IRQ].miss);
+    kernel_printf("\tzeroed pages : %x pages, %x hits, %x misses\n", buddy.zero_pool.count, buddy.zero_pool.hit,
+                  buddy.zero_pool.miss);
+    kernel_printf("\tfree pages : %x, watermarks : %x low, %x high, kswapd runs : %x\n", buddy.nr_free_pages,
+                  buddy.wmark_low, buddy.wmark_high, kswapd_runs);
 }
 
+#ifdef BUDDY_BITMAP
+/*
+ * toggle the pair bit of the block (page_idx) at (order)
+ * return the old value, non-zero means the two buddies were in different states
+ */
+static unsigned int change_pair_bit(unsigned int page_idx, unsigned int order) {
+    unsigned int bit = page_idx >> (order + 1);
+    unsigned int *word = buddy.freelist[order].map + (bit >> 5);
+    unsigned int mask = 1 << (bit & 31);
+    unsigned int old = *word & mask;
+
+    *word ^= mask;
+    return old;
+}
+
+/*
+ * allocate the pair bitmaps of every order in one piece, all buddies start as "in use"
+ * it is sized by max_pfn, as it must be taken from bootmm before the buddy range is fixed
+ */
+void init_buddy_map() {
+    unsigned int nr_pages = bmm.max_pfn;
+    unsigned int words[MAX_BUDDY_ORDER];
+    unsigned int total = 0;
+    unsigned int *map;
+    unsigned int i;
+
+    for (i = 0; i < MAX_BUDDY_ORDER; i++) {
+        words[i] = ((nr_pages >> (i + 1)) + 31) >> 5;
+        total += words[i];
+    }
+    map = (unsigned int *)bootmm_alloc_pages(total * sizeof(unsigned int), _MM_KERNEL, 1 << PAGE_SHIFT);
+    if (!map) {
+        kernel_printf("\nERROR : bootmm_alloc_pages failed!\nInit buddy bitmap failed!\n");
+        while (1)
+            ;
+    }
+    map = (unsigned int *)((unsigned int)map | 0x80000000);
+    kernel_memset_word(map, 0, total);
+    for (i = 0; i < MAX_BUDDY_ORDER; i++) {
+        buddy.freelist[i].map = map;
+        map += words[i];
+    }
+    buddy.freelist[MAX_BUDDY_ORDER].map = 0;
+}
+#endif  // ! BUDDY_BITMAP
+
 // this function is to init all memory with page struct
 void init_pages(unsigned int start_pfn, unsigned int end_pfn) {
     unsigned int i;
     for (i = start_pfn; i < end_pfn; i++) {
         clean_flag(pages + i, -1);
         set_flag(pages + i, _PAGE_RESERVED);
-        (pages + i)->reference = 1;
-        (pages + i)->virtual = (void *)(-1);
-        (pages + i)->bplevel = (-1);
-        (pages + i)->slabp = 0;  // initially, the free space is the whole page
+        set_ref(pages + i, 1);
+        set_bplevel(pages + i, -1);
         INIT_LIST_HEAD(&(pages[i].list));
     }
 }
 
+/*
+ * hand [start_pfn, end_pfn) to buddy as the largest aligned blocks that fit
+ * boot pages go straight into the freelists, not into the page caches
+ * every page gets a clean flag word, not only the block heads: the merge check
+ * without BUDDY_BITMAP reads the flag of a buddy that may be inside another block
+ */
+void free_pages_range(unsigned int start_pfn, unsigned int end_pfn) {
+    struct page *page = pages + start_pfn;
+    struct page *end = pages + end_pfn;
+    unsigned int page_idx, order, i;
+
+    lockup(&buddy.lock);
+    while (page < end) {
+        page_idx = page - buddy.start_page;
+        order = MAX_BUDDY_ORDER;
+        while ((page_idx & ((1 << order) - 1)) || (page + (1 << order) > end))
+            --order;
+        for (i = 0; i < (1 << order); i++)
+            page[i].flag = _PAGE_RESERVED | _PAGE_BPLEVEL_MASK;
+        __buddy_free(page, order);
+        page += (1 << order);
+    }
+    unlock(&buddy.lock);
+}
+
 void init_buddy() {
     unsigned int bpsize = sizeof(struct page);
     unsigned char *bp_base;
-    unsigned int i;
+    unsigned int i, j;
 
     bp_base = bootmm_alloc_pages(bpsize * bmm.max_pfn, _MM_KERNEL, 1 << PAGE_SHIFT);
     if (!bp_base) {
@@ -54,7 +151,9 @@ void init_buddy() {
     }
     pages = (struct page *)((unsigned int)bp_base | 0x80000000);
 
-    init_pages(0, bmm.max_pfn);
+#ifdef BUDDY_BITMAP
+    init_buddy_map();
+#endif  // ! BUDDY_BITMAP
 
     kernel_start_pfn = 0;
     kernel_end_pfn = 0;
@@ -64,24 +163,54 @@ void init_buddy() {
     }
     kernel_end_pfn >>= PAGE_SHIFT;
 
-    buddy.buddy_start_pfn = (kernel_end_pfn + (1 << MAX_BUDDY_ORDER) - 1) &
-                            ~((1 << MAX_BUDDY_ORDER) - 1);              // the pages that bootmm using cannot be merged into buddy_sys
+    // the pages that bootmm using cannot be merged into buddy_sys
+    buddy.buddy_start_pfn = kernel_end_pfn + 1;
     buddy.buddy_end_pfn = bmm.max_pfn & ~((1 << MAX_BUDDY_ORDER) - 1);  // remain 2 pages for I/O
 
-    // init freelists of all bplevels
+    // init freelists of all bplevels, every block starts as unmovable
     for (i = 0; i < MAX_BUDDY_ORDER + 1; i++) {
         buddy.freelist[i].nr_free = 0;
-        INIT_LIST_HEAD(&(buddy.freelist[i].free_head));
+        for (j = 0; j < MIGRATE_TYPES; j++)
+            INIT_LIST_HEAD(&(buddy.freelist[i].free_head[j]));
     }
-    buddy.start_page = pages + buddy.buddy_start_pfn;
+    for (i = 0; i < sizeof(pageblock_type); i++)
+        pageblock_type[i] = MIGRATE_UNMOVABLE;
+    /*
+     * buddy index is counted from a max-order aligned base, so that a 4MB block
+     * is also 4MB aligned physically; the reserved pages between the base and
+     * buddy_start_pfn are never freed, so they simply never merge
+     */
+    buddy.start_page = pages + (buddy.buddy_start_pfn & ~((1 << MAX_BUDDY_ORDER) - 1));
     init_lock(&(buddy.lock));
+    INIT_LIST_HEAD(&shrinkers);
+    kswapd_wake = 0;
+    buddy.nr_free_pages = 0;
+    buddy.wmark_low = (buddy.buddy_end_pfn - buddy.buddy_start_pfn) >> WMARK_LOW_SHIFT;
+    buddy.wmark_high = (buddy.buddy_end_pfn - buddy.buddy_start_pfn) >> WMARK_HIGH_SHIFT;
 
-    for (i = buddy.buddy_start_pfn; i < buddy.buddy_end_pfn; ++i) {
-        __free_pages(pages + i, 0);
+    for (i = 0; i < PCP_COUNT; i++) {
+        buddy.pcp[i].count = 0;
+        buddy.pcp[i].hit = 0;
+        buddy.pcp[i].miss = 0;
+        INIT_LIST_HEAD(&(buddy.pcp[i].list));
     }
+    buddy.zero_pool.count = 0;
+    buddy.zero_pool.hit = 0;
+    buddy.zero_pool.miss = 0;
+    INIT_LIST_HEAD(&(buddy.zero_pool.list));
+    register_shrinker(&zero_pool_shrinker);
+
+    /*
+     * only the pages outside the buddy range are set up here, the pages inside it
+     * get their struct page written when free_pages_range() hands them over
+     */
+    init_pages(0, buddy.buddy_start_pfn);
+    init_pages(buddy.buddy_end_pfn, bmm.max_pfn);
+    bootmm_free_extents(buddy.buddy_start_pfn, buddy.buddy_end_pfn, free_pages_range);
 }
 
-void __free_pages(struct page *pbpage, unsigned int bplevel) {
+// put one block back into the freelists and merge it upward, buddy.lock must be held
+static void __buddy_free(struct page *pbpage, unsigned int bplevel) {
     /* page_idx -> the current page
      * bgroup_idx -> the buddy group that current page is in
      */
@@ -89,12 +218,8 @@ void __free_pages(struct page *pbpage, unsigned int bplevel) {
     unsigned int combined_idx, tmp;
     struct page *bgroup_page;
 
-    // dec_ref(pbpage, 1);
-    // if(pbpage->reference)
-    //	return;
-
-    lockup(&buddy.lock);
-
+    clean_flag(pbpage, _PAGE_ALLOCED | _PAGE_SLAB);
+    buddy.nr_free_pages += 1 << bplevel;
     page_idx = pbpage - buddy.start_page;
     // complier do the sizeof(struct) operation, and now page_idx is the index
 
@@ -102,11 +227,18 @@ void __free_pages(struct page *pbpage, unsigned int bplevel) {
         bgroup_idx = page_idx ^ (1 << bplevel);
         bgroup_page = pbpage + (bgroup_idx - page_idx);
         // kernel_printf("group%x %x\n", (page_idx), bgroup_idx);
-        if (!_is_same_bplevel(bgroup_page, bplevel)) {
+#ifdef BUDDY_BITMAP
+        // the bit was 0: both buddies were in use, the other one still is
+        if (!change_pair_bit(page_idx, bplevel))
+            break;
+#else
+        // an allocated block keeps its order in bplevel (for kfree), so both must be checked
+        if (!_is_same_bplevel(bgroup_page, bplevel) || has_flag(bgroup_page, _PAGE_ALLOCED)) {
             // kernel_printf("%x %x\n", bgroup_page->bplevel, bplevel);
 
             break;
         }
+#endif  // ! BUDDY_BITMAP
         list_del_init(&bgroup_page->list);
         --buddy.freelist[bplevel].nr_free;
         set_bplevel(bgroup_page, -1);
@@ -116,54 +248,382 @@ void __free_pages(struct page *pbpage, unsigned int bplevel) {
         ++bplevel;
     }
     set_bplevel(pbpage, bplevel);
-    list_add(&(pbpage->list), &(buddy.freelist[bplevel].free_head));
+    list_add(&(pbpage->list), &(buddy.freelist[bplevel].free_head[get_pageblock_type(pbpage)]));
     ++buddy.freelist[bplevel].nr_free;
     // kernel_printf("v%x__addto__%x\n", &(pbpage->list),
     // &(buddy.freelist[bplevel].free_head));
-    unlock(&buddy.lock);
 }
 
-struct page *__alloc_pages(unsigned int bplevel) {
+// get the smallest order whose block can hold (size) bytes
+unsigned int get_order(unsigned int size) {
+    unsigned int order = 0;
+
+    size = (size + (1 << PAGE_SHIFT) - 1) >> PAGE_SHIFT;
+    while ((1 << order) < size)
+        ++order;
+    return order;
+}
+
+/*
+ * take one block of (bplevel) out of the freelists, splitting a larger one if needed, buddy.lock must be held
+ * when (migratetype) has nothing left, the largest free block of another type is taken,
+ * a large enough one also moves its whole max-order block over to (migratetype)
+ * the halves split off go to the freelist of the type their max-order block has now
+ */
+static struct page *__buddy_alloc(unsigned int bplevel, unsigned int migratetype) {
     unsigned int current_order, size;
+    unsigned int page_idx, type;
     struct page *page, *buddy_page;
     struct freelist *free;
 
-    lockup(&buddy.lock);
-
     for (current_order = bplevel; current_order <= MAX_BUDDY_ORDER; ++current_order) {
         free = buddy.freelist + current_order;
-        if (!list_empty(&(free->free_head)))
+        if (!list_empty(&(free->free_head[migratetype]))) {
+            page = container_of(free->free_head[migratetype].next, struct page, list);
             goto found;
+        }
+    }
+
+    for (current_order = MAX_BUDDY_ORDER + 1; current_order-- > bplevel;) {
+        free = buddy.freelist + current_order;
+        for (type = 0; type < MIGRATE_TYPES; type++) {
+            if (type == migratetype || list_empty(&(free->free_head[type])))
+                continue;
+            page = container_of(free->free_head[type].next, struct page, list);
+            if (current_order >= PAGEBLOCK_CLAIM_ORDER)
+                set_pageblock_type(page, migratetype);
+            goto found;
+        }
     }
 
-    unlock(&buddy.lock);
     return 0;
 
 found:
-    page = container_of(free->free_head.next, struct page, list);
     list_del_init(&(page->list));
+    page->flag = _PAGE_RESERVED | _PAGE_ALLOCED;
     set_bplevel(page, bplevel);
-    set_flag(page, _PAGE_ALLOCED);
     // set_ref(page, 1);
     --(free->nr_free);
+    buddy.nr_free_pages -= 1 << bplevel;
+#ifdef BUDDY_BITMAP
+    page_idx = page - buddy.start_page;
+    if (current_order < MAX_BUDDY_ORDER)
+        change_pair_bit(page_idx, current_order);
+#endif  // ! BUDDY_BITMAP
 
+    type = get_pageblock_type(page);
     size = 1 << current_order;
     while (current_order > bplevel) {
         --free;
         --current_order;
         size >>= 1;
         buddy_page = page + size;
-        list_add(&(buddy_page->list), &(free->free_head));
+        buddy_page->flag = _PAGE_RESERVED;
+        list_add(&(buddy_page->list), &(free->free_head[type]));
         ++(free->nr_free);
         set_bplevel(buddy_page, current_order);
+#ifdef BUDDY_BITMAP
+        // one half goes on, the other half stays free
+        change_pair_bit(page_idx, current_order);
+#endif  // ! BUDDY_BITMAP
     }
 
+    return page;
+}
+
+/*
+ * order-0 pages go through a small cache in front of the freelists,
+ * task context and interrupt context each have their own one:
+ *   the interrupt one is only used with status.EXL set, so it can never be re-entered
+ *   the task one only needs interrupts masked, which also keeps a task switch out
+ * so neither takes buddy.lock unless it has to refill or drain a batch
+ */
+static struct page *pcp_alloc() {
+    struct page_cache *pcp;
+    struct page *page;
+    unsigned int irq = in_interrupt();
+    unsigned int old_ie = 0;
+    unsigned int i;
+
+    pcp = buddy.pcp + (irq ? PCP_IRQ : PCP_TASK);
+    if (!irq)
+        old_ie = disable_interrupts();
+
+    if (!pcp->count) {
+        ++pcp->miss;
+        lockup(&buddy.lock);
+        for (i = 0; i < PCP_BATCH; i++) {
+            page = __buddy_alloc(0, MIGRATE_UNMOVABLE);
+            if (!page)
+                break;
+            list_add_tail(&(page->list), &(pcp->list));
+            ++pcp->count;
+        }
+        unlock(&buddy.lock);
+        if (!pcp->count) {
+            page = 0;
+            goto out;
+        }
+    } else
+        ++pcp->hit;
+
+    page = container_of(pcp->list.next, struct page, list);
+    list_del_init(&(page->list));
+    --pcp->count;
+out:
+    if (old_ie)
+        enable_interrupts();
+    return page;
+}
+
+// the page stays marked as allocated in buddy while it sits in the cache
+static void pcp_free(struct page *page) {
+    struct page_cache *pcp;
+    unsigned int irq = in_interrupt();
+    unsigned int old_ie = 0;
+    unsigned int i;
+
+    pcp = buddy.pcp + (irq ? PCP_IRQ : PCP_TASK);
+    if (!irq)
+        old_ie = disable_interrupts();
+
+    clean_flag(page, _PAGE_SLAB);
+    list_add(&(page->list), &(pcp->list));
+    ++pcp->count;
+
+    // too many cached pages, give the coldest batch back to buddy
+    if (pcp->count > PCP_HIGH) {
+        lockup(&buddy.lock);
+        for (i = 0; i < PCP_BATCH; i++) {
+            page = container_of(pcp->list.prev, struct page, list);
+            list_del_init(&(page->list));
+            __buddy_free(page, 0);
+        }
+        pcp->count -= PCP_BATCH;
+        unlock(&buddy.lock);
+    }
+
+    if (old_ie)
+        enable_interrupts();
+}
+
+// give every cached page back to the freelists, return the number of pages
+static unsigned int pcp_drain() {
+    struct page_cache *pcp;
+    struct page *page;
+    unsigned int old_ie;
+    unsigned int drained = 0;
+
+    old_ie = disable_interrupts();
+    lockup(&buddy.lock);
+    for (pcp = buddy.pcp; pcp < buddy.pcp + PCP_COUNT; pcp++) {
+        while (pcp->count) {
+            page = container_of(pcp->list.next, struct page, list);
+            list_del_init(&(page->list));
+            __buddy_free(page, 0);
+            --pcp->count;
+            ++drained;
+        }
+    }
     unlock(&buddy.lock);
+    if (old_ie)
+        enable_interrupts();
+    return drained;
+}
+
+// clear a block word by word through kseg0
+static void clear_pages(struct page *page, unsigned int order) {
+    unsigned int *addr = (unsigned int *)(((page - pages) << PAGE_SHIFT) | 0x80000000);
+
+    kernel_memset_word(addr, 0, (1 << (PAGE_SHIFT - 2)) << order);
+}
+
+static struct page *zero_pool_alloc() {
+    struct page *page = 0;
+    unsigned int old_ie;
+
+    old_ie = disable_interrupts();
+    if (buddy.zero_pool.count) {
+        page = container_of(buddy.zero_pool.list.next, struct page, list);
+        list_del_init(&(page->list));
+        --buddy.zero_pool.count;
+        ++buddy.zero_pool.hit;
+    } else
+        ++buddy.zero_pool.miss;
+    if (old_ie)
+        enable_interrupts();
     return page;
 }
 
-void *alloc_pages(unsigned int bplevel) {
-    struct page *page = __alloc_pages(bplevel);
+// the zero pool shrinker: give every pooled page back
+static unsigned int zero_pool_shrink() {
+    struct page *page;
+    unsigned int old_ie;
+    unsigned int freed = 0;
+
+    while (1) {
+        old_ie = disable_interrupts();
+        page = 0;
+        if (buddy.zero_pool.count) {
+            page = container_of(buddy.zero_pool.list.next, struct page, list);
+            list_del_init(&(page->list));
+            --buddy.zero_pool.count;
+        }
+        if (old_ie)
+            enable_interrupts();
+        if (!page)
+            break;
+        __free_pages(page, 0);
+        ++freed;
+    }
+    return freed;
+}
+
+void __free_pages(struct page *pbpage, unsigned int bplevel) {
+    // dec_ref(pbpage, 1);
+    // if(pbpage->reference)
+    //	return;
+
+    // the page caches only hold unmovable pages
+    if (!bplevel && get_pageblock_type(pbpage) == MIGRATE_UNMOVABLE)
+        return pcp_free(pbpage);
+
+    lockup(&buddy.lock);
+    __buddy_free(pbpage, bplevel);
+    unlock(&buddy.lock);
+}
+
+static struct page *alloc_pages_once(unsigned int bplevel, unsigned int migratetype) {
+    struct page *page;
+
+    if (!bplevel && migratetype == MIGRATE_UNMOVABLE)
+        return pcp_alloc();
+
+    lockup(&buddy.lock);
+    page = __buddy_alloc(bplevel, migratetype);
+    unlock(&buddy.lock);
+    return page;
+}
+
+struct page *__alloc_pages_gfp(unsigned int bplevel, unsigned int gfp) {
+    struct page *page = 0;
+    unsigned int migratetype = (gfp & __GFP_RECLAIMABLE) ? MIGRATE_RECLAIMABLE : MIGRATE_UNMOVABLE;
+
+    if (bplevel > MAX_BUDDY_ORDER)
+        return 0;
+
+    // a pooled page is cleared already
+    if ((gfp & __GFP_ZERO) && !bplevel && migratetype == MIGRATE_UNMOVABLE) {
+        page = zero_pool_alloc();
+        if (page)
+            gfp &= ~__GFP_ZERO;
+    }
+
+    if (!page) {
+        page = alloc_pages_once(bplevel, migratetype);
+
+        // out of memory, reclaim directly and retry once if anything came back
+        if (!page && shrink_all())
+            page = alloc_pages_once(bplevel, migratetype);
+    }
+
+    if (buddy.nr_free_pages < buddy.wmark_low && !kswapd_wake) {
+        kswapd_wake = 1;
+        if (kswapd_task)
+            wake_up_process(kswapd_task);
+    }
+
+    if (page && (gfp & __GFP_ZERO))
+        clear_pages(page, bplevel);
+    return page;
+}
+
+/*
+ * add one cleared page to the zero pool, called again and again by the idle task
+ * nothing is taken while memory runs short, so that the pool never causes reclaim
+ * return 0 if there was nothing to do
+ */
+unsigned int refill_zero_pool() {
+    struct page *page;
+    unsigned int old_ie;
+
+    if (buddy.zero_pool.count >= ZERO_POOL_HIGH || buddy.nr_free_pages < buddy.wmark_high)
+        return 0;
+
+    // the pool is given back by its shrinker, so it lives with the other reclaimable pages
+    page = alloc_pages_once(0, MIGRATE_RECLAIMABLE);
+    if (!page)
+        return 0;
+    clear_pages(page, 0);
+
+    old_ie = disable_interrupts();
+    list_add(&(page->list), &(buddy.zero_pool.list));
+    ++buddy.zero_pool.count;
+    if (old_ie)
+        enable_interrupts();
+    return 1;
+}
+
+void register_shrinker(struct shrinker *s) {
+    unsigned int old_ie;
+
+    old_ie = disable_interrupts();
+    list_add_tail(&(s->list), &shrinkers);
+    if (old_ie)
+        enable_interrupts();
+}
+
+/*
+ * call every shrinker once, then drain the page caches: the order-0 pages a shrinker
+ * frees may have stopped there, where neither nr_free_pages nor a larger order sees them
+ * return 0 if nothing was given back
+ */
+unsigned int shrink_all() {
+    struct list_head *pos;
+    struct shrinker *s;
+    unsigned int freed = 0;
+
+    list_for_each(pos, &shrinkers) {
+        s = container_of(pos, struct shrinker, list);
+        freed += s->shrink();
+    }
+    return freed + pcp_drain();
+}
+
+// kswapd looks at kswapd_wake at least this often
+#define KSWAPD_TIMEOUT_MS 1000
+
+/*
+ * the background reclaim task: once woken by an allocation leaving less than
+ * wmark_low free pages, shrink until wmark_high is reached or nothing is left to
+ * give, so that allocations rarely have to reclaim by themselves
+ * it sleeps on the wait list in between, its state is set before kswapd_wake is
+ * tested, so a wakeup in between makes schedule_timeout() return at once
+ */
+void kswapd() {
+    kswapd_task = current_task;
+    while (1) {
+        current_task->state = TASK_WAITING;
+        if (!kswapd_wake) {
+            schedule_timeout(KSWAPD_TIMEOUT_MS);
+            continue;
+        }
+        current_task->state = TASK_RUNNING;
+        ++kswapd_runs;
+        while (buddy.nr_free_pages < buddy.wmark_high) {
+            if (!shrink_all())
+                break;
+        }
+        kswapd_wake = 0;
+    }
+}
+
+struct page *__alloc_pages(unsigned int bplevel) {
+    return __alloc_pages_gfp(bplevel, GFP_KERNEL);
+}
+
+void *alloc_pages_gfp(unsigned int bplevel, unsigned int gfp) {
+    struct page *page = __alloc_pages_gfp(bplevel, gfp);
 
     if (!page)
         return 0;
@@ -171,6 +631,106 @@ void *alloc_pages(unsigned int bplevel) {
     return (void *)((page - pages) << PAGE_SHIFT);
 }
 
+void *alloc_pages(unsigned int bplevel) {
+    return alloc_pages_gfp(bplevel, GFP_KERNEL);
+}
+
 void free_pages(void *addr, unsigned int bplevel) {
     __free_pages(pages + ((unsigned int)addr >> PAGE_SHIFT), bplevel);
 }
+
+/*
+ * unusable free space index of every order: the part of the free memory that is
+ * in blocks too small for an allocation of this order, in 1/1000
+ */
+void buddy_fraginfo() {
+    unsigned int order, type;
+    unsigned int total = 0, usable = 0;
+    unsigned int index;
+    unsigned int count[MIGRATE_TYPES];
+    struct list_head *pos;
+
+    lockup(&buddy.lock);
+    for (order = 0; order <= MAX_BUDDY_ORDER; ++order)
+        total += buddy.freelist[order].nr_free << order;
+
+    kernel_printf("Buddy fragmentation : %x free pages\n", total);
+    for (order = MAX_BUDDY_ORDER + 1; order-- > 0;) {
+        usable += buddy.freelist[order].nr_free << order;
+        index = total ? (total - usable) * 1000 / total : 0;
+        for (type = 0; type < MIGRATE_TYPES; type++) {
+            count[type] = 0;
+            list_for_each(pos, &(buddy.freelist[order].free_head[type])) {
+                ++count[type];
+            }
+        }
+        kernel_printf("\t(%x)# : unusable %d/1000, unmovable %x, reclaimable %x\n", order, index, count[MIGRATE_UNMOVABLE],
+                      count[MIGRATE_RECLAIMABLE]);
+    }
+    unlock(&buddy.lock);
+}
+
+#define BUDDY_BENCH_ROUNDS 64
+#define BUDDY_BENCH_ORDERS 4
+
+/*
+ * time BUDDY_BENCH_ROUNDS allocations and frees of (order), in cycles per call
+ * (cached) goes through __alloc_pages/__free_pages, else straight to the freelists,
+ * so that order 0 also runs the merge path instead of hitting the page caches
+ */
+static void buddy_bench_pass(unsigned int order, unsigned int cached, unsigned int *alloc, unsigned int *free) {
+    struct page *blocks[BUDDY_BENCH_ROUNDS];
+    unsigned int i, old_ie;
+    unsigned int start, middle, end;
+
+    old_ie = disable_interrupts();
+    start = get_cp0_count();
+    for (i = 0; i < BUDDY_BENCH_ROUNDS; i++) {
+        if (cached) {
+            blocks[i] = __alloc_pages(order);
+        } else {
+            lockup(&buddy.lock);
+            blocks[i] = __buddy_alloc(order, MIGRATE_UNMOVABLE);
+            unlock(&buddy.lock);
+        }
+    }
+    middle = get_cp0_count();
+    for (i = 0; i < BUDDY_BENCH_ROUNDS; i++) {
+        if (!blocks[i])
+            continue;
+        if (cached) {
+            __free_pages(blocks[i], order);
+        } else {
+            lockup(&buddy.lock);
+            __buddy_free(blocks[i], order);
+            unlock(&buddy.lock);
+        }
+    }
+    end = get_cp0_count();
+    if (old_ie)
+        enable_interrupts();
+
+    *alloc = (middle - start) / BUDDY_BENCH_ROUNDS;
+    *free = (end - middle) / BUDDY_BENCH_ROUNDS;
+}
+
+/*
+ * measure the cycles of the freelists with CP0 count, for BUDDY_BITMAP against bplevel
+ * interrupts are kept off, so that no interrupt handler is counted in
+ * the order-0 page caches are timed on a line of their own
+ */
+void buddy_bench() {
+    unsigned int order, alloc, free;
+
+#ifdef BUDDY_BITMAP
+    kernel_printf("Buddy-bench (bitmap) :\n");
+#else
+    kernel_printf("Buddy-bench (bplevel) :\n");
+#endif  // ! BUDDY_BITMAP
+    for (order = 0; order < BUDDY_BENCH_ORDERS; order++) {
+        buddy_bench_pass(order, 0, &alloc, &free);
+        kernel_printf("\torder %d : alloc %d cycles, free %d cycles\n", order, alloc, free);
+    }
+    buddy_bench_pass(0, 1, &alloc, &free);
+    kernel_printf("\tpage cache : alloc %d cycles, free %d cycles\n", alloc, free);
+}
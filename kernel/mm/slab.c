@@ -1,9 +1,22 @@
 #include <arch.h>
+#include <intr.h>
 #include <driver/vga.h>
 #include <zjunix/slab.h>
 #include <zjunix/utils.h>
 
 #define KMEM_ADDR(PAGE, BASE) ((((PAGE) - (BASE)) << PAGE_SHIFT) | 0x80000000)
+#define KMEM_PAGE(ADDR) (pages + (((unsigned int)(ADDR) & ~KERNEL_ENTRY) >> PAGE_SHIFT))
+
+// slab pages are of order 0 - SLAB_MAX_ORDER, the smallest one wasting less than SLAB_MAX_WASTE percent is used
+#define SLAB_MAX_ORDER 3
+#define SLAB_MAX_WASTE 12
+#define SLAB_BYTES(cache) ((1 << PAGE_SHIFT) << (cache)->order)
+
+// kmalloc size -> kmalloc_caches index, one entry for every KMALLOC_ALIGN bytes
+#define KMALLOC_SHIFT 3
+#define KMALLOC_ALIGN (1 << KMALLOC_SHIFT)
+#define KMALLOC_MAX_SIZE 2048
+static unsigned char kmalloc_index[KMALLOC_MAX_SIZE >> KMALLOC_SHIFT];
 
 /*
  * one list of PAGE_SHIFT(now it's 12) possbile memory size
@@ -14,6 +27,15 @@ struct kmem_cache kmalloc_caches[PAGE_SHIFT];
 
 static unsigned int size_kmem_cache[PAGE_SHIFT] = {96, 192, 8, 16, 32, 64, 128, 256, 512, 1024, 1536, 2048};
 
+// every cache in the system, kmalloc ones included
+struct list_head slab_caches;
+
+// the caches made by kmem_cache_create() are themselves allocated from here
+struct kmem_cache kmem_cache_cache;
+
+// gives the empty slab pages back under memory pressure
+static struct shrinker slab_shrinker = {slab_shrink};
+
 // init the struct kmem_cache_cpu
 void init_kmem_cpu(struct kmem_cache_cpu *kcpu) {
     kcpu->page = 0;
@@ -24,24 +46,116 @@ void init_kmem_cpu(struct kmem_cache_cpu *kcpu) {
 void init_kmem_node(struct kmem_cache_node *knode) {
     INIT_LIST_HEAD(&(knode->full));
     INIT_LIST_HEAD(&(knode->partial));
+    INIT_LIST_HEAD(&(knode->empty));
+    knode->nr_empty = 0;
+}
+
+// the offset of the first object in a slab page, right after the slab_head
+static unsigned int slab_first_offset(struct kmem_cache *cache) {
+    return (sizeof(struct slab_head) + cache->align - 1) & ~(cache->align - 1);
+}
+
+// the number of objects a slab of (order) holds
+static unsigned int slab_objs(struct kmem_cache *cache, unsigned int order) {
+    return (((1 << PAGE_SHIFT) << order) - slab_first_offset(cache)) / cache->size;
 }
 
-void init_each_slab(struct kmem_cache *cache, unsigned int size) {
+// pick the smallest slab order wasting less than SLAB_MAX_WASTE, else the one wasting least
+void calculate_order(struct kmem_cache *cache) {
+    unsigned int order, bytes, objs, waste;
+    unsigned int best_waste = 100;
+
+    cache->order = 0;
+    for (order = 0; order <= SLAB_MAX_ORDER; order++) {
+        objs = slab_objs(cache, order);
+        if (!objs)
+            continue;
+        bytes = (1 << PAGE_SHIFT) << order;
+        waste = (bytes - objs * cache->size) * 100 / bytes;
+        if (waste < best_waste) {
+            best_waste = waste;
+            cache->order = order;
+        }
+        if (waste < SLAB_MAX_WASTE)
+            break;
+    }
+}
+
+/*
+ * (align) must be a power of 2, every object starts on it
+ * a free object is chained through its first word, unless the cache has a (ctor):
+ * then the word is added after the object to keep it in its initialized state
+ */
+void init_each_slab(struct kmem_cache *cache, char *name, unsigned int size, unsigned int align, unsigned int flags,
+                    void (*ctor)(void *)) {
+    unsigned int i;
+    unsigned int ralign;
+    unsigned int left;
+
+    if (flags & SLAB_HWCACHE_ALIGN) {
+        for (ralign = L1_CACHE_BYTES; size <= (ralign >> 1); ralign >>= 1)
+            ;
+        if (align < ralign)
+            align = ralign;
+    }
+    if (align < SIZE_INT)
+        align = SIZE_INT;
+    cache->align = align;
     cache->objsize = size;
     cache->objsize += (SIZE_INT - 1);
     cache->objsize &= ~(SIZE_INT - 1);
-    cache->size = cache->objsize + sizeof(void *);  // add one char as mark(available)
-    cache->offset = cache->size;
+    cache->size = cache->objsize;
+    cache->offset = 0;
+    if (ctor) {
+        cache->size += sizeof(void *);  // add one pointer to chain the free objects
+        cache->offset = cache->objsize;
+    }
+    cache->size += (align - 1);
+    cache->size &= ~(align - 1);
+    cache->ctor = ctor;
+    calculate_order(cache);
+
+    // the space left at the end of a slab shifts the first object of each new slab
+    left = SLAB_BYTES(cache) - slab_first_offset(cache) - slab_objs(cache, cache->order) * cache->size;
+    cache->color_off = (align > L1_CACHE_BYTES) ? align : L1_CACHE_BYTES;
+    cache->color = left / cache->color_off + 1;
+    cache->color_next = 0;
+    for (i = 0; i < sizeof(cache->name) - 1 && name[i]; i++)
+        cache->name[i] = name[i];
+    cache->name[i] = 0;
     init_kmem_cpu(&(cache->cpu));
     init_kmem_node(&(cache->node));
+    list_add_tail(&(cache->list), &slab_caches);
+}
+
+// find the best-fit slab system for (size)
+unsigned int get_slab(unsigned int size) {
+    unsigned int itop = PAGE_SHIFT;
+    unsigned int i;
+    unsigned int bf_num = (1 << (PAGE_SHIFT - 1)) + 1;  // up to half page
+    unsigned int bf_index = PAGE_SHIFT;                 // record the best fit num & index
+
+    for (i = 0; i < itop; i++) {
+        if ((kmalloc_caches[i].objsize >= size) && (kmalloc_caches[i].objsize < bf_num)) {
+            bf_num = kmalloc_caches[i].objsize;
+            bf_index = i;
+        }
+    }
+    return bf_index;
 }
 
 void init_slab() {
     unsigned int i;
 
+    INIT_LIST_HEAD(&slab_caches);
+    init_each_slab(&kmem_cache_cache, "kmem_cache", sizeof(struct kmem_cache), SIZE_INT, 0, 0);
     for (i = 0; i < PAGE_SHIFT; i++) {
-        init_each_slab(&(kmalloc_caches[i]), size_kmem_cache[i]);
+        init_each_slab(&(kmalloc_caches[i]), "kmalloc", size_kmem_cache[i], SIZE_INT, SLAB_HWCACHE_ALIGN, 0);
     }
+    // every size in a KMALLOC_ALIGN step fits the same class, all classes are multiples of it
+    for (i = 0; i < (KMALLOC_MAX_SIZE >> KMALLOC_SHIFT); i++)
+        kmalloc_index[i] = get_slab((i + 1) << KMALLOC_SHIFT);
+    register_shrinker(&slab_shrinker);
 #ifdef SLAB_DEBUG
     kernel_printf("Setup Slub ok :\n");
     kernel_printf("\tcurrent slab cache size list:\n\t");
@@ -49,169 +163,522 @@ void init_slab() {
         kernel_printf("%x %x ", kmalloc_caches[i].objsize, (unsigned int)(&(kmalloc_caches[i])));
     }
     kernel_printf("\n");
+    slab_info();
 #endif  // ! SLAB_DEBUG
 }
 
-// ATTENTION: sl_objs is the reuse of bplevel
-// ATTENTION: slabp must be set right to add itself to reach the end of the page
-// 		e.g. if size = 96 then 4096 / 96 = .. .. 64 then slabp starts at
-// 64
+// efficiency of every cache: the part of a slab taken by object data, in 1/100
+void slab_info() {
+    struct list_head *pos;
+    struct kmem_cache *cache;
+    unsigned int objs;
+
+#ifdef SLAB_LLSC
+    kernel_printf("Slab-system (ll/sc) :\n");
+#else
+    kernel_printf("Slab-system (interrupts off) :\n");
+#endif  // ! SLAB_LLSC
+    list_for_each(pos, &slab_caches) {
+        cache = container_of(pos, struct kmem_cache, list);
+        objs = slab_objs(cache, cache->order);
+        kernel_printf("\t%s-%d : order %d, %d objs, efficiency %d/100, %d colors, %d empty\n", cache->name, cache->objsize,
+                      cache->order, objs, objs * cache->objsize * 100 / SLAB_BYTES(cache), cache->color, cache->node.nr_empty);
+    }
+}
+
+/*
+ * the free objects of a page are chained through the word at (offset) of each
+ * object, page->slabp is the head of the chain and 0 ends it
+ * the constructor of the cache runs here, once for every object of the new page
+ * in a multi-page slab, the tail pages point back to the head page through (virtual)
+ * the objects start (color_next * color_off) bytes later in each new slab, so the same
+ * object of different slabs does not always fall into the same cache set
+ */
 void format_slabpage(struct kmem_cache *cache, struct page *page) {
-    unsigned char *moffset = (unsigned char *)KMEM_ADDR(page, pages);  // physical addr
-    struct slab_head *s_head = (struct slab_head *)moffset;
+    unsigned char *base = (unsigned char *)KMEM_ADDR(page, pages);
+    unsigned char *end = base + SLAB_BYTES(cache);
+    unsigned char *moffset = base + slab_first_offset(cache) + cache->color_next * cache->color_off;
+    struct slab_head *s_head = (struct slab_head *)base;
     unsigned int *ptr;
-    unsigned int remaining = (1 << PAGE_SHIFT);
+    unsigned int i;
 
+    if (++(cache->color_next) >= cache->color)
+        cache->color_next = 0;
+
+    page->virtual = (void *)cache;
+    page->slabp = (unsigned int)moffset;
     set_flag(page, _PAGE_SLAB);
+    for (i = 1; i < (1 << cache->order); i++) {
+        page[i].flag = _PAGE_RESERVED | _PAGE_ALLOCED | _PAGE_TAIL;
+        page[i].virtual = (void *)page;
+    }
+
     do {
+        if (cache->ctor)
+            cache->ctor(moffset);
         ptr = (unsigned int *)(moffset + cache->offset);
         moffset += cache->size;
         *ptr = (unsigned int)moffset;
-        remaining -= cache->size;
-    } while (remaining >= cache->size);
+    } while (moffset + cache->size <= end);
+    *ptr = 0;
 
-    *ptr = (unsigned int)moffset & ~((1 << PAGE_SHIFT) - 1);
-    s_head->end_ptr = ptr;
+    INIT_LIST_HEAD(&(s_head->list));
     s_head->nr_objs = 0;
+}
 
-    cache->cpu.page = page;
-    cache->cpu.freeobj = (void **)(*ptr + cache->offset);
-    page->virtual = (void *)cache;
-    page->slabp = (unsigned int)(*(cache->cpu.freeobj));
+// the head page of the slab (addr) is in
+static struct page *slab_page(void *addr) {
+    struct page *page = KMEM_PAGE(addr);
+
+    if (has_flag(page, _PAGE_TAIL))
+        page = (struct page *)page->virtual;
+    return page;
 }
 
-void *slab_alloc(struct kmem_cache *cache) {
+// give an empty slab back to buddy
+static void free_slab(struct kmem_cache *cache, struct page *page) {
+    unsigned int i;
+
+    for (i = 1; i < (1 << cache->order); i++)
+        clean_flag(page + i, _PAGE_TAIL);
+    __free_pages(page, cache->order);
+}
+
+// keep an empty slab for the next allocation, unless enough are kept already
+static void put_empty_slab(struct kmem_cache *cache, struct page *page) {
+    struct slab_head *s_head = (struct slab_head *)KMEM_ADDR(page, pages);
+
+    if (cache->node.nr_empty >= SLAB_MAX_EMPTY) {
+        free_slab(cache, page);
+        return;
+    }
+    list_add(&(s_head->list), &(cache->node.empty));
+    ++(cache->node.nr_empty);
+}
+
+/*
+ * the active freelist (cpu.freeobj) holds the free objects of cpu.page
+ * page->slabp of the active page stays 0, its nr_objs counts every object
+ */
+#ifdef SLAB_LLSC
+/*
+ * popped and pushed with ll/sc and interrupts left enabled: eret clears LLbit,
+ * so sc fails whenever an interrupt has run in between and may have touched
+ * the list, the operation is then just retried
+ */
+static void *cpu_freelist_pop(struct kmem_cache *cache) {
+    void *object;
+    unsigned int next;
+
+    asm volatile(
+        "1:\n\t"
+        "ll %0, 0(%2)\n\t"
+        "beqz %0, 2f\n\t"
+        "addu %1, %0, %3\n\t"
+        "lw %1, 0(%1)\n\t"
+        "sc %1, 0(%2)\n\t"
+        "beqz %1, 1b\n\t"
+        "2:\n\t"
+        : "=&r"(object), "=&r"(next)
+        : "r"(&(cache->cpu.freeobj)), "r"(cache->offset)
+        : "memory");
+    return object;
+}
+
+// return 0 without pushing if (page) is not the active page of (cache)
+static int cpu_freelist_push(struct kmem_cache *cache, struct page *page, void *object) {
+    unsigned int *next = (unsigned int *)((unsigned char *)object + cache->offset);
+    unsigned int head, cur;
+    int ret;
+
+    asm volatile(
+        "1:\n\t"
+        "lw %1, 0(%3)\n\t"
+        "sw %1, 0(%6)\n\t"
+        "ll %2, 0(%3)\n\t"
+        "bne %2, %1, 1b\n\t"
+        "lw %2, 0(%4)\n\t"
+        "move %0, $zero\n\t"
+        "bne %2, %5, 2f\n\t"
+        "move %0, %7\n\t"
+        "sc %0, 0(%3)\n\t"
+        "beqz %0, 1b\n\t"
+        "2:\n\t"
+        : "=&r"(ret), "=&r"(head), "=&r"(cur)
+        : "r"(&(cache->cpu.freeobj)), "r"(&(cache->cpu.page)), "r"(page), "r"(next), "r"(object)
+        : "memory");
+    return ret;
+}
+#else
+// no ll/sc on this core: interrupts are turned off around the update instead
+static void *cpu_freelist_pop(struct kmem_cache *cache) {
+    void *object;
+    unsigned int old_ie;
+
+    old_ie = disable_interrupts();
+    object = cache->cpu.freeobj;
+    if (object)
+        cache->cpu.freeobj = *(void ***)((unsigned char *)object + cache->offset);
+    if (old_ie)
+        enable_interrupts();
+    return object;
+}
+
+// return 0 without pushing if (page) is not the active page of (cache)
+static int cpu_freelist_push(struct kmem_cache *cache, struct page *page, void *object) {
+    unsigned int old_ie;
+    int ret = 0;
+
+    old_ie = disable_interrupts();
+    if (cache->cpu.page == page) {
+        *(void ***)((unsigned char *)object + cache->offset) = cache->cpu.freeobj;
+        cache->cpu.freeobj = (void **)object;
+        ret = 1;
+    }
+    if (old_ie)
+        enable_interrupts();
+    return ret;
+}
+#endif  // ! SLAB_LLSC
+
+// give the active page back to the node lists, interrupts must be off
+static void deactivate_slab(struct kmem_cache *cache) {
+    struct page *page = cache->cpu.page;
+    struct slab_head *s_head = (struct slab_head *)KMEM_ADDR(page, pages);
+    unsigned char *object = (unsigned char *)cache->cpu.freeobj;
+
+    page->slabp = (unsigned int)object;
+    while (object) {
+        --(s_head->nr_objs);
+        object = (unsigned char *)*(unsigned int *)(object + cache->offset);
+    }
+    init_kmem_cpu(&(cache->cpu));
+
+    if (!(s_head->nr_objs))
+        put_empty_slab(cache, page);
+    else if (!page->slabp)
+        list_add_tail(&(s_head->list), &(cache->node.full));
+    else
+        list_add_tail(&(s_head->list), &(cache->node.partial));
+}
+
+/*
+ * make a partial, empty or new page the active one, interrupts must be off
+ * return 0 if buddy has no page left even after reclaiming, the active freelist is empty then
+ */
+static unsigned int new_cpu_slab(struct kmem_cache *cache) {
     struct slab_head *s_head;
-    void *object = 0;
-    struct page *newpage;
-
-    if (cache->cpu.freeobj)
-        object = *(cache->cpu.freeobj);
-
-slalloc_check:
-    // 1st: check if the freeobj is in the boundary situation
-    if (is_bound((unsigned int)object, (1 << PAGE_SHIFT))) {
-        // 2nd: the page is full
-        if (cache->cpu.page) {
-            list_add_tail(&(cache->cpu.page->list), &(cache->node.full));
-        }
+    struct page *page;
 
-        if (list_empty(&(cache->node.partial))) {
-            // call the buddy system to allocate one more page to be slab-cache
-            newpage = __alloc_pages(0);  // get bplevel = 0 page === one page
-            if (!newpage) {
-                // allocate failed, memory in system is used up
-                kernel_printf("ERROR: slab request one page in cache failed\n");
-                while (1)
-                    ;
-            }
+    if (cache->cpu.page)
+        deactivate_slab(cache);
+
+    if (!list_empty(&(cache->node.partial))) {
+        s_head = container_of(cache->node.partial.next, struct slab_head, list);
+        list_del_init(&(s_head->list));
+        page = KMEM_PAGE(s_head);
+    } else if (!list_empty(&(cache->node.empty))) {
+        s_head = container_of(cache->node.empty.next, struct slab_head, list);
+        list_del_init(&(s_head->list));
+        --(cache->node.nr_empty);
+        page = KMEM_PAGE(s_head);
+    } else {
+        // empty slabs go back to buddy through slab_shrink(), keep them out of the unmovable blocks
+        page = __alloc_pages_gfp(cache->order, __GFP_RECLAIMABLE);
+        if (!page) {
+            // allocate failed, memory in system is used up
 #ifdef SLAB_DEBUG
-            kernel_printf("\tnew page, index: %x \n", newpage - pages);
+            kernel_printf("ERROR: slab request pages in cache failed\n");
 #endif  // ! SLAB_DEBUG
-        // using standard format to shape the new-allocated page,
-        // set the new page to be cpu.page
-            format_slabpage(cache, newpage);
-            object = *(cache->cpu.freeobj);
-            // as it's newly allocated no check may be need
-            goto slalloc_check;
+            return 0;
         }
-        // get the header of the cpu.page(struct page)
-        cache->cpu.page = container_of(cache->node.partial.next, struct page, list);
-        list_del(cache->node.partial.next);
-        object = (void *)(cache->cpu.page->slabp);
-        cache->cpu.freeobj = (void **)((unsigned char *)object + cache->offset);
-        goto slalloc_check;
-    }
-slalloc_normal:
-    cache->cpu.freeobj = (void **)((unsigned char *)object + cache->offset);
-    cache->cpu.page->slabp = (unsigned int)(*(cache->cpu.freeobj));
-    s_head = (struct slab_head *)KMEM_ADDR(cache->cpu.page, pages);
-    ++(s_head->nr_objs);
-slalloc_end:
-    // slab may be full after this allocation
-    if (is_bound(cache->cpu.page->slabp, 1 << PAGE_SHIFT)) {
-        list_add_tail(&(cache->cpu.page->list), &(cache->node.full));
-        init_kmem_cpu(&(cache->cpu));
+#ifdef SLAB_DEBUG
+        kernel_printf("\tnew page, index: %x \n", page - pages);
+#endif  // ! SLAB_DEBUG
+        format_slabpage(cache, page);
+        s_head = (struct slab_head *)KMEM_ADDR(page, pages);
     }
+
+    // move the whole free chain of the page to the active freelist
+    s_head->nr_objs = slab_objs(cache, cache->order);
+    cache->cpu.freeobj = (void **)page->slabp;
+    page->slabp = 0;
+    cache->cpu.page = page;
+    return 1;
+}
+
+// the active freelist is empty, take a partial page or a new one from buddy
+static void *__slab_alloc(struct kmem_cache *cache) {
+    unsigned int old_ie;
+    void *object;
+
+    old_ie = disable_interrupts();
+
+    // an interrupt may have refilled it before they were disabled
+    object = cpu_freelist_pop(cache);
+    if (!object && new_cpu_slab(cache))
+        object = cpu_freelist_pop(cache);
+
+    if (old_ie)
+        enable_interrupts();
     return object;
 }
 
-void slab_free(struct kmem_cache *cache, void *object) {
-    struct page *opage = pages + ((unsigned int)object >> PAGE_SHIFT);
-    unsigned int *ptr;
+void *slab_alloc(struct kmem_cache *cache) {
+    void *object = cpu_freelist_pop(cache);
+
+    if (!object)
+        object = __slab_alloc(cache);
+    return object;
+}
+
+/*
+ * give back (cnt) objects of (opage) chained from (head) to (tail), interrupts must be off
+ * the chain goes to the active freelist in one step if (opage) is the active page
+ */
+static void free_chain(struct kmem_cache *cache, struct page *opage, void *head, void *tail, unsigned int cnt) {
     struct slab_head *s_head = (struct slab_head *)KMEM_ADDR(opage, pages);
+    unsigned int *ptr = (unsigned int *)((unsigned char *)tail + cache->offset);
 
-    if (!(s_head->nr_objs)) {
+    if (opage == cache->cpu.page) {
+        *ptr = (unsigned int)cache->cpu.freeobj;
+        cache->cpu.freeobj = (void **)head;
+        return;
+    }
+
+    if (s_head->nr_objs < cnt) {
         kernel_printf("ERROR : slab_free error!\n");
         // die();
         while (1)
             ;
     }
 
-    ptr = (unsigned int *)((unsigned char *)object + cache->offset);
-    *ptr = *((unsigned int *)(s_head->end_ptr));
-    *((unsigned int *)(s_head->end_ptr)) = (unsigned int)object;
-    --(s_head->nr_objs);
+    *ptr = opage->slabp;
+    opage->slabp = (unsigned int)head;
+    s_head->nr_objs -= cnt;
 
-    if (list_empty(&(opage->list)))
-        return;
+    list_del_init(&(s_head->list));
+    if (!(s_head->nr_objs))
+        put_empty_slab(cache, opage);
+    else
+        list_add_tail(&(s_head->list), &(cache->node.partial));
+}
 
-    if (!(s_head->nr_objs)) {
-        __free_pages(opage, 0);
-        return;
+// (object) is not in the active page
+static void __slab_free(struct kmem_cache *cache, struct page *opage, void *object) {
+    unsigned int old_ie;
+
+    // the page may have been made active before interrupts were disabled
+    old_ie = disable_interrupts();
+    free_chain(cache, opage, object, object, 1);
+    if (old_ie)
+        enable_interrupts();
+}
+
+void slab_free(struct kmem_cache *cache, void *object) {
+    struct page *opage = slab_page(object);
+
+    if (!cpu_freelist_push(cache, opage, object))
+        __slab_free(cache, opage, object);
+}
+
+/*
+ * create a cache of objects of (size) bytes starting on (align)
+ * (flags) may ask for SLAB_HWCACHE_ALIGN, for caches of hot objects
+ * (ctor) may be 0, else it initializes every object when its slab page is formatted,
+ * objects must be given back to kmem_cache_free() in that initialized state
+ * return 0 if one object cannot fit into a slab of SLAB_MAX_ORDER
+ */
+struct kmem_cache *kmem_cache_create(char *name, unsigned int size, unsigned int align, unsigned int flags,
+                                     void (*ctor)(void *)) {
+    struct kmem_cache *cache;
+
+    if (!size)
+        return 0;
+
+    cache = (struct kmem_cache *)slab_alloc(&kmem_cache_cache);
+    if (!cache)
+        return 0;
+    init_each_slab(cache, name, size, align, flags, ctor);
+    if (!slab_objs(cache, cache->order)) {
+        list_del(&(cache->list));
+        slab_free(&kmem_cache_cache, cache);
+        return 0;
     }
+    return cache;
+}
 
-    list_del_init(&(opage->list));
-    list_add_tail(&(opage->list), &(cache->node.partial));
+// give the empty pages of (cache) back to buddy, return the number of pages freed
+unsigned int kmem_cache_shrink(struct kmem_cache *cache) {
+    struct slab_head *s_head;
+    unsigned int old_ie;
+    unsigned int freed = 0;
+
+    old_ie = disable_interrupts();
+    while (!list_empty(&(cache->node.empty))) {
+        s_head = container_of(cache->node.empty.next, struct slab_head, list);
+        list_del_init(&(s_head->list));
+        free_slab(cache, KMEM_PAGE(s_head));
+        freed += 1 << cache->order;
+    }
+    cache->node.nr_empty = 0;
+    if (old_ie)
+        enable_interrupts();
+    return freed;
 }
 
-// find the best-fit slab system for (size)
-unsigned int get_slab(unsigned int size) {
-    unsigned int itop = PAGE_SHIFT;
-    unsigned int i;
-    unsigned int bf_num = (1 << (PAGE_SHIFT - 1));  // half page
-    unsigned int bf_index = PAGE_SHIFT;             // record the best fit num & index
+// the slab shrinker: shrink every cache
+unsigned int slab_shrink() {
+    struct list_head *pos;
+    unsigned int freed = 0;
 
-    for (i = 0; i < itop; i++) {
-        if ((kmalloc_caches[i].objsize >= size) && (kmalloc_caches[i].objsize < bf_num)) {
-            bf_num = kmalloc_caches[i].objsize;
-            bf_index = i;
-        }
+    list_for_each(pos, &slab_caches) {
+        freed += kmem_cache_shrink(container_of(pos, struct kmem_cache, list));
     }
-    return bf_index;
+    return freed;
+}
+
+void *kmem_cache_alloc(struct kmem_cache *cache) {
+    return slab_alloc(cache);
+}
+
+void kmem_cache_free(struct kmem_cache *cache, void *obj) {
+    slab_free(cache, (void *)((unsigned int)obj | KERNEL_ENTRY));
 }
 
 void *kmalloc(unsigned int size) {
     struct kmem_cache *cache;
-    unsigned int bf_index;
+    struct page *page;
 
     if (!size)
         return 0;
 
     // if the size larger than the max size of slab system, then call buddy to
-    // solve this
-    if (size > kmalloc_caches[PAGE_SHIFT - 1].objsize) {
-        size += (1 << PAGE_SHIFT) - 1;
-        size &= ~((1 << PAGE_SHIFT) - 1);
-        return (void *)(KERNEL_ENTRY | (unsigned int)alloc_pages(size >> PAGE_SHIFT));
+    // solve this, the order is kept in the head page's bplevel for kfree
+    if (size > KMALLOC_MAX_SIZE) {
+        page = __alloc_pages(get_order(size));
+        if (!page)
+            return 0;
+        return (void *)KMEM_ADDR(page, pages);
     }
 
-    bf_index = get_slab(size);
-    if (bf_index >= PAGE_SHIFT) {
-        kernel_printf("ERROR: No available slab\n");
-        while (1)
-            ;
+    // slab objects are kseg0 addresses already, 0 if memory is used up
+    cache = kmalloc_caches + kmalloc_index[(size - 1) >> KMALLOC_SHIFT];
+    return slab_alloc(cache);
+}
+
+// kmalloc() of cleared memory, whole pages come from the zero pool
+void *kzalloc(unsigned int size) {
+    struct page *page;
+    void *obj;
+
+    if (size > KMALLOC_MAX_SIZE) {
+        page = __alloc_pages_gfp(get_order(size), GFP_KERNEL | __GFP_ZERO);
+        if (!page)
+            return 0;
+        return (void *)KMEM_ADDR(page, pages);
     }
-    return (void *)(KERNEL_ENTRY | (unsigned int)slab_alloc(&(kmalloc_caches[bf_index])));
+
+    obj = kmalloc(size);
+    if (obj)
+        kernel_memset(obj, 0, size);
+    return obj;
 }
 
 void kfree(void *obj) {
     struct page *page;
 
-    obj = (void *)((unsigned int)obj & (~KERNEL_ENTRY));
-    page = pages + ((unsigned int)obj >> PAGE_SHIFT);
-    if (!(page->flag == _PAGE_SLAB))
-        return free_pages((void *)((unsigned int)obj & ~((1 << PAGE_SHIFT) - 1)), page->bplevel);
+    if (!obj)
+        return;
+
+    page = slab_page(obj);
+    if (!has_flag(page, _PAGE_SLAB))
+        return free_pages((void *)(((unsigned int)obj & ~KERNEL_ENTRY) & ~((1 << PAGE_SHIFT) - 1)), get_bplevel(page));
+
+    return slab_free(page->virtual, (void *)((unsigned int)obj | KERNEL_ENTRY));
+}
+
+// take (nr) objects of (cache) into (p) with interrupts disabled once, return the number taken
+unsigned int kmem_cache_alloc_bulk(struct kmem_cache *cache, unsigned int nr, void **p) {
+    unsigned int old_ie;
+    unsigned int i;
+    unsigned char *object;
+
+    old_ie = disable_interrupts();
+    for (i = 0; i < nr; i++) {
+        object = (unsigned char *)cache->cpu.freeobj;
+        if (!object) {
+            if (!new_cpu_slab(cache))
+                break;
+            object = (unsigned char *)cache->cpu.freeobj;
+        }
+        cache->cpu.freeobj = (void **)*(unsigned int *)(object + cache->offset);
+        p[i] = (void *)object;
+    }
+    if (old_ie)
+        enable_interrupts();
+    return i;
+}
+
+unsigned int kmalloc_bulk(unsigned int size, unsigned int nr, void **p) {
+    unsigned int i;
+
+    if (!size)
+        return 0;
 
-    return slab_free(page->virtual, obj);
+    if (size > KMALLOC_MAX_SIZE) {
+        for (i = 0; i < nr; i++) {
+            p[i] = kmalloc(size);
+            if (!p[i])
+                break;
+        }
+        return i;
+    }
+    return kmem_cache_alloc_bulk(kmalloc_caches + kmalloc_index[(size - 1) >> KMALLOC_SHIFT], nr, p);
+}
+
+/*
+ * free (nr) objects of (p), from kmalloc() or any cache, 0 entries are skipped
+ * a run of objects of one slab is chained together and given back in one step,
+ * so the array is walked once; their entries in (p) are cleared on the way
+ */
+void kfree_bulk(unsigned int nr, void **p) {
+    struct kmem_cache *cache = 0;
+    struct page *page, *run = 0;
+    unsigned char *object, *head = 0, *tail = 0;
+    unsigned int old_ie;
+    unsigned int i, cnt = 0;
+
+    old_ie = disable_interrupts();
+    for (i = 0; i < nr; i++) {
+        if (!p[i])
+            continue;
+        page = slab_page(p[i]);
+        if (!has_flag(page, _PAGE_SLAB)) {
+            kfree(p[i]);
+            p[i] = 0;
+            continue;
+        }
+
+        object = (unsigned char *)((unsigned int)p[i] | KERNEL_ENTRY);
+        p[i] = 0;
+        if (page == run) {
+            *(unsigned int *)(tail + cache->offset) = (unsigned int)object;
+            tail = object;
+            ++cnt;
+            continue;
+        }
+
+        // another slab, the run so far goes back first
+        if (run)
+            free_chain(cache, run, head, tail, cnt);
+        run = page;
+        cache = (struct kmem_cache *)page->virtual;
+        head = tail = object;
+        cnt = 1;
+    }
+    if (run)
+        free_chain(cache, run, head, tail, cnt);
+    if (old_ie)
+        enable_interrupts();
 }
@@ -0,0 +1,467 @@
+#include <arch.h>
+#include <driver/vga.h>
+#include <exc.h>
+#include <page.h>
+#include <zjunix/buddy.h>
+#include <zjunix/fs/fat.h>
+#include <zjunix/pc.h>
+#include <zjunix/slab.h>
+#include <zjunix/utils.h>
+#include <zjunix/vm.h>
+
+// Cause.ExcCode of the TLB exceptions
+#define EXC_MOD 1
+#define EXC_TLBL 2
+#define EXC_TLBS 3
+
+// the kseg0 address of a page frame
+#define PAGE_KVA(page) ((((page)-pages) << PAGE_SHIFT) | 0x80000000)
+
+// an open file shared by the regions mapping it, closed with the last of them
+struct vm_file {
+    FILE file;
+    unsigned int count;
+};
+
+// kernel tasks map nothing in kuseg, so the refill handler never has to check for a missing pgd
+static unsigned int *empty_pgd[PTRS_PER_PGD];
+
+unsigned int **current_pgd = empty_pgd;
+struct mm_struct *current_mm;
+unsigned int tlb_refills;
+unsigned int page_faults;
+
+struct vm_file *vm_file_open(char *filename) {
+    struct vm_file *file;
+
+    file = (struct vm_file *)kmalloc(sizeof(struct vm_file));
+    if (!file)
+        return 0;
+    if (fs_open(&(file->file), (unsigned char *)filename) != 0) {
+        kfree(file);
+        return 0;
+    }
+    file->count = 1;
+    return file;
+}
+
+unsigned int vm_file_size(struct vm_file *file) {
+    return get_entry_filesize(file->file.entry.data);
+}
+
+// read (size) bytes at (offset) of (file) into kernel memory, return the bytes read
+unsigned int vm_file_read(struct vm_file *file, unsigned int offset, void *buf, unsigned int size) {
+    unsigned int ret;
+
+    // the position of the file is shared with the page fault handler, which reads it too
+    fs_lock();
+    fs_lseek(&(file->file), offset);
+    ret = fs_read(&(file->file), (unsigned char *)buf, size);
+    fs_unlock();
+    return ret;
+}
+
+void vm_file_put(struct vm_file *file) {
+    if (--file->count)
+        return;
+    fs_close(&(file->file));
+    kfree(file);
+}
+
+// drop one reference of a user page, it is freed with the last one
+static void put_user_page(unsigned int pte) {
+    struct page *page = pages + (ENTRYLO_TO_PA(pte) >> PAGE_SHIFT);
+
+    dec_ref(page, 1);
+    if (!get_ref(page))
+        __free_pages(page, 0);
+}
+
+// write back the data cache and drop the instruction cache of freshly written user code
+static void sync_icache(unsigned int kva, unsigned int size) {
+    unsigned int addr;
+
+    for (addr = kva; addr < kva + size; addr += L1_CACHE_BYTES)
+        kernel_cache(addr);
+}
+
+struct mm_struct *mm_create(unsigned int asid) {
+    struct mm_struct *mm;
+
+    mm = (struct mm_struct *)kmalloc(sizeof(struct mm_struct));
+    if (!mm)
+        return 0;
+
+    // a cleared page, there is no pte page yet
+    mm->pgd = (unsigned int **)kzalloc(1 << PAGE_SHIFT);
+    if (!mm->pgd) {
+        kfree(mm);
+        return 0;
+    }
+    mm->asid = asid & 0xff;
+    INIT_LIST_HEAD(&(mm->regions));
+    return mm;
+}
+
+// free the user pages, the regions and the page tables of (mm), and drop its TLB entries
+void mm_delete(struct mm_struct *mm) {
+    struct vm_region *region;
+    unsigned int *pte;
+    unsigned int i, j;
+
+    for (i = 0; i < PTRS_PER_PGD; i++) {
+        pte = mm->pgd[i];
+        if (!pte)
+            continue;
+        for (j = 0; j < PTRS_PER_PTE; j++) {
+            if (pte[j])
+                put_user_page(pte[j]);
+        }
+        kfree(pte);
+    }
+    while (!list_empty(&(mm->regions))) {
+        region = container_of(mm->regions.next, struct vm_region, list);
+        list_del(&(region->list));
+        if (region->file)
+            vm_file_put(region->file);
+        kfree(region);
+    }
+    // the asid goes to the next task with this pid
+    tlb_flush_asid(mm->asid);
+    if (current_pgd == mm->pgd)
+        current_pgd = empty_pgd;
+    if (current_mm == mm)
+        current_mm = 0;
+    kfree(mm->pgd);
+    kfree(mm);
+}
+
+/*
+ * map the page at physical (pa) to user (va), (flags) are EntryLo bits like ENTRYLO_D
+ * the page then belongs to (mm) and is freed by mm_delete()
+ * return 1 if (va) is not in kuseg or no pte page could be allocated
+ */
+int mm_map_page(struct mm_struct *mm, unsigned int va, unsigned int pa, unsigned int flags) {
+    unsigned int **pgd;
+
+    if (va >= USER_SPACE_END)
+        return 1;
+
+    pgd = mm->pgd + pgd_index(va);
+    if (!*pgd) {
+        *pgd = (unsigned int *)kzalloc(1 << PAGE_SHIFT);
+        if (!*pgd)
+            return 1;
+    }
+    set_ref(pages + (pa >> PAGE_SHIFT), 1);
+    (*pgd)[pte_index(va)] = ENTRYLO_PFN(pa) | ENTRYLO_CACHED | ENTRYLO_V | flags;
+    return 0;
+}
+
+/*
+ * make (mm) the current address space and (asid) the current ASID, (mm) may be 0
+ * the TLB entries of the other tasks carry their own ASID, so none is flushed
+ */
+void mm_switch(struct mm_struct *mm, unsigned int asid) {
+    current_mm = mm;
+    current_pgd = mm ? mm->pgd : empty_pgd;
+    asm volatile(
+        "mtc0 %0, $10\n\t"
+        "nop\n\t"
+        "nop"
+        :
+        : "r"(asid & 0xff));
+}
+
+/*
+ * add [start, start + size) of kuseg to (mm), nothing is mapped until it is touched
+ * (start) must be page aligned, the region takes a reference of (file) if there is one
+ * return 1 if the range does not fit in kuseg or memory is used up
+ */
+int mm_add_region(struct mm_struct *mm, unsigned int start, unsigned int size, unsigned int flags,
+                  struct vm_file *file, unsigned int offset, unsigned int filesz) {
+    struct vm_region *region;
+    unsigned int end = start + ((size + (1 << PAGE_SHIFT) - 1) & ~((1 << PAGE_SHIFT) - 1));
+
+    if ((start & ((1 << PAGE_SHIFT) - 1)) || end <= start || end > USER_SPACE_END)
+        return 1;
+
+    region = (struct vm_region *)kmalloc(sizeof(struct vm_region));
+    if (!region)
+        return 1;
+    region->start = start;
+    region->end = end;
+    region->flags = flags;
+    region->file = file;
+    region->offset = offset;
+    region->filesz = filesz;
+    if (file)
+        file->count++;
+    list_add_tail(&(region->list), &(mm->regions));
+    return 0;
+}
+
+/*
+ * a copy of (mm) for a new task with (asid), the pages are shared instead of copied
+ * writable pages lose ENTRYLO_D on both sides and take PTE_COW, read-only ones are just shared
+ * return 0 if memory is used up
+ */
+struct mm_struct *mm_dup(struct mm_struct *mm, unsigned int asid) {
+    struct mm_struct *new_mm;
+    struct list_head *pos;
+    struct vm_region *region;
+    unsigned int *pte, *new_pte;
+    unsigned int i, j;
+
+    new_mm = mm_create(asid);
+    if (!new_mm)
+        return 0;
+
+    list_for_each(pos, &(mm->regions)) {
+        region = container_of(pos, struct vm_region, list);
+        if (mm_add_region(new_mm, region->start, region->end - region->start, region->flags, region->file,
+                          region->offset, region->filesz))
+            goto error;
+    }
+
+    for (i = 0; i < PTRS_PER_PGD; i++) {
+        pte = mm->pgd[i];
+        if (!pte)
+            continue;
+        new_pte = (unsigned int *)kzalloc(1 << PAGE_SHIFT);
+        if (!new_pte)
+            goto error;
+        for (j = 0; j < PTRS_PER_PTE; j++) {
+            if (!pte[j])
+                continue;
+            if (pte[j] & ENTRYLO_D)
+                pte[j] = (pte[j] & ~ENTRYLO_D) | PTE_COW;
+            new_pte[j] = pte[j];
+            inc_ref(pages + (ENTRYLO_TO_PA(pte[j]) >> PAGE_SHIFT), 1);
+        }
+        new_mm->pgd[i] = new_pte;
+    }
+    // the TLB may still hold writable entries of the old side
+    tlb_flush_asid(mm->asid);
+    return new_mm;
+
+error:
+    tlb_flush_asid(mm->asid);
+    mm_delete(new_mm);
+    return 0;
+}
+
+static struct vm_region *find_region(struct mm_struct *mm, unsigned int va) {
+    struct list_head *pos;
+    struct vm_region *region;
+
+    list_for_each(pos, &(mm->regions)) {
+        region = container_of(pos, struct vm_region, list);
+        if (va >= region->start && va < region->end)
+            return region;
+    }
+    return 0;
+}
+
+// the pte of (va) in (mm), 0 if it has no pte page
+static unsigned int *find_pte(struct mm_struct *mm, unsigned int va) {
+    unsigned int *pte = mm->pgd[pgd_index(va)];
+
+    return pte ? pte + pte_index(va) : 0;
+}
+
+// fault_in() found the fs held by another task, nothing is mapped and the access is retried
+#define FAULT_RETRY 2
+
+/*
+ * load the page of (va) on its first touch, return 1 if (va) is in no region or memory is used up
+ * the file is read right here with status.EXL set, the SD driver polls the card and never
+ * waits for an interrupt; a task switched out in the middle of a fs call holds the fs, and
+ * as this can not wait for it, FAULT_RETRY is returned instead
+ */
+static int fault_in(struct mm_struct *mm, unsigned int va) {
+    struct vm_region *region;
+    struct page *page;
+    unsigned int offset, size;
+
+    region = find_region(mm, va);
+    if (!region)
+        return 1;
+
+    va &= ~((1 << PAGE_SHIFT) - 1);
+    offset = va - region->start;
+    size = 0;
+    if (region->file && offset < region->filesz) {
+        size = region->filesz - offset;
+        if (size > (1 << PAGE_SHIFT))
+            size = 1 << PAGE_SHIFT;
+        if (fs_trylock())
+            return FAULT_RETRY;
+    }
+    page = __alloc_pages_gfp(0, __GFP_ZERO);
+    if (page && size) {
+        // through the file cache, the rest of the page stays zero
+        fs_lseek(&(region->file->file), region->offset + offset);
+        fs_read(&(region->file->file), (unsigned char *)PAGE_KVA(page), size);
+        sync_icache(PAGE_KVA(page), size);
+    }
+    if (size)
+        fs_unlock();
+    if (!page)
+        return 1;
+
+    if (mm_map_page(mm, va, (page - pages) << PAGE_SHIFT, region->flags)) {
+        __free_pages(page, 0);
+        return 1;
+    }
+    return 0;
+}
+
+// the first write to a shared page, the last user takes it over, return 1 if memory is used up
+static int break_cow(unsigned int *pte) {
+    struct page *page = pages + (ENTRYLO_TO_PA(*pte) >> PAGE_SHIFT);
+    struct page *copy;
+
+    if (get_ref(page) > 1) {
+        copy = __alloc_pages(0);
+        if (!copy)
+            return 1;
+        kernel_memcpy((void *)PAGE_KVA(copy), (void *)PAGE_KVA(page), 1 << PAGE_SHIFT);
+        sync_icache(PAGE_KVA(copy), 1 << PAGE_SHIFT);
+        dec_ref(page, 1);
+        set_ref(copy, 1);
+        *pte = ENTRYLO_PFN((copy - pages) << PAGE_SHIFT) | (*pte & 0x3f);
+    }
+    *pte = (*pte & ~PTE_COW) | ENTRYLO_D;
+    return 0;
+}
+
+/*
+ * the kseg0 address of user (va) in the current space for reading, its page is loaded if needed
+ * for handlers running with status.EXL set, which must not touch kuseg themselves
+ * return 0 if (va) is in no region or its page can not be loaded now
+ */
+void *user_kva(unsigned int va) {
+    unsigned int *pte;
+
+    if (va >= USER_SPACE_END || !current_mm)
+        return 0;
+    pte = find_pte(current_mm, va);
+    if ((!pte || !*pte) && fault_in(current_mm, va))
+        return 0;
+    pte = find_pte(current_mm, va);
+    return (void *)((ENTRYLO_TO_PA(*pte) | 0x80000000) + (va & ((1 << PAGE_SHIFT) - 1)));
+}
+
+/*
+ * TLB invalid and modified exceptions of kuseg, runs with status.EXL set
+ * the refill handler has left an invalid or read-only entry for the pair, once the pte
+ * is fixed the pair is written over it right here, so the retried access hits
+ * a TLBL/TLBS with no entry for the pair is a miss taken with status.EXL set already:
+ * it came here instead of the refill handler and EPC still belongs to the outer exception,
+ * so the access can not be retried, see current_mm
+ */
+static void do_page_fault(unsigned int status, unsigned int cause, context *pt_context) {
+    unsigned int va, *pte;
+    int ret;
+
+    asm volatile("mfc0 %0, $8\n\t" : "=r"(va));
+    page_faults++;
+    if (va >= USER_SPACE_END || !current_mm)
+        exc_kill(status, cause, pt_context);
+
+    pte = find_pte(current_mm, va);
+    if (((cause >> 2) & 0x1f) == EXC_MOD) {
+        if (!pte || !(*pte & PTE_COW) || break_cow(pte))
+            exc_kill(status, cause, pt_context);
+    } else if (!pte || !*pte) {
+        ret = fault_in(current_mm, va);
+        // the pair stays invalid and the access faults again after eret,
+        // a tick can come in between and run the task holding the fs
+        if (ret == FAULT_RETRY)
+            return;
+        if (ret)
+            exc_kill(status, cause, pt_context);
+    }
+
+    // the pte page exists now, PTE_COW is a software bit and stays out of EntryLo
+    pte = find_pte(current_mm, va & 0xffffe000);
+    if (tlb_update_page(va, current_mm->asid, pte[0] & ~PTE_COW, pte[1] & ~PTE_COW) &&
+        ((cause >> 2) & 0x1f) != EXC_MOD) {
+        kernel_printf("ERROR : kuseg %x touched with status.EXL set\n", va);
+        exc_kill(status, cause, pt_context);
+    }
+}
+
+void init_vm() {
+    register_exception_handler(EXC_MOD, do_page_fault);
+    register_exception_handler(EXC_TLBL, do_page_fault);
+    register_exception_handler(EXC_TLBS, do_page_fault);
+}
+
+#define COW_TEST_VA 0x00400000
+#define COW_TEST_OLD 0x11111111
+#define COW_TEST_PARENT 0x22222222
+#define COW_TEST_CHILD 0x33333333
+
+static volatile unsigned int cow_child_seen, cow_child_wrote;
+
+// the child of cow_test(), it runs in its copy-on-write copy of the parent's space
+static void cow_test_child(unsigned int argc, void *argv) {
+    volatile unsigned int *p = (volatile unsigned int *)COW_TEST_VA;
+
+    cow_child_seen = *p;
+    *p = COW_TEST_CHILD;
+    cow_child_wrote = *p;
+    task_exit();
+}
+
+/*
+ * give the running kernel task a space with one written page, spawn a user task that
+ * shares it, and let both write to it: each must see only its own write afterwards,
+ * the child the value from before its spawn
+ */
+void cow_test() {
+    volatile unsigned int *p = (volatile unsigned int *)COW_TEST_VA;
+    struct mm_struct *mm;
+    unsigned int faults, parent;
+    pid_t pid;
+
+    if (current_task->mm) {
+        kernel_printf("Cow-test : the task has an address space already\n");
+        return;
+    }
+    mm = mm_create(current_task->ASID);
+    if (!mm || mm_add_region(mm, COW_TEST_VA, 1 << PAGE_SHIFT, ENTRYLO_D, 0, 0, 0)) {
+        kernel_printf("Cow-test : out of memory\n");
+        if (mm)
+            mm_delete(mm);
+        return;
+    }
+    current_task->mm = mm;
+    mm_switch(mm, current_task->ASID);
+
+    faults = page_faults;
+    *p = COW_TEST_OLD;
+    cow_child_seen = 0;
+    cow_child_wrote = 0;
+    // the child gets the space through mm_dup(), the page is shared from here on
+    if (task_create("cowtest", 0, cow_test_child, 0, 0, &pid, 1)) {
+        kernel_printf("Cow-test : task created failed\n");
+        goto out;
+    }
+    *p = COW_TEST_PARENT;
+    wait_pid(pid);
+    parent = *p;
+
+    kernel_printf("Cow-test : parent %x, child saw %x and wrote %x, %d page faults\n", parent, cow_child_seen,
+                  cow_child_wrote, page_faults - faults);
+    if (parent == COW_TEST_PARENT && cow_child_seen == COW_TEST_OLD && cow_child_wrote == COW_TEST_CHILD)
+        kernel_printf("Cow-test : passed\n");
+    else
+        kernel_printf("Cow-test : FAILED\n");
+
+out:
+    current_task->mm = 0;
+    mm_delete(mm);
+}
@@ -0,0 +1,296 @@
+#include <arch.h>
+#include <driver/vga.h>
+#include <intr.h>
+#include <page.h>
+#include <zjunix/buddy.h>
+#include <zjunix/slab.h>
+#include <zjunix/vm.h>
+#include <zjunix/vmalloc.h>
+
+/*
+ * EntryLo of every page of the window, read by the TLB refill handler
+ * an unmapped page still has ENTRYLO_G: the TLB takes G of a pair as the AND of both
+ * halves, and a pair with one unmapped half would else be tagged with the current ASID,
+ * out of reach of tlb_flush_page() from any other task
+ */
+unsigned int vmalloc_pgtable[VMALLOC_SIZE >> PAGE_SHIFT];
+
+// the vm_areas in use, sorted by address
+static struct list_head vm_areas;
+
+#define VMALLOC_PTE(ADDR) (vmalloc_pgtable + (((ADDR)-VMALLOC_START) >> PAGE_SHIFT))
+
+#define LARGEMAP_SLOTS (TLB_WIRED - TLB_WIRED_FIRST)
+
+// address of the large mapping each wired entry belongs to, 0 if it is free
+static unsigned int large_owner[LARGEMAP_SLOTS];
+
+void init_vmalloc() {
+    unsigned int i;
+
+    for (i = 0; i < (VMALLOC_SIZE >> PAGE_SHIFT); i++)
+        vmalloc_pgtable[i] = ENTRYLO_G;
+    INIT_LIST_HEAD(&vm_areas);
+    for (i = 0; i < LARGEMAP_SLOTS; i++)
+        large_owner[i] = 0;
+}
+
+/*
+ * find the first gap of the window that holds (size) bytes and a guard page,
+ * and link (area) there, interrupts must be off
+ * return 0 if the window is used up
+ */
+static unsigned int insert_vm_area(struct vm_area *area, unsigned int size) {
+    struct list_head *pos;
+    struct vm_area *next;
+    unsigned int addr = VMALLOC_START;
+
+    list_for_each(pos, &vm_areas) {
+        next = container_of(pos, struct vm_area, list);
+        if (addr + size + (1 << PAGE_SHIFT) <= next->addr)
+            break;
+        addr = next->addr + next->size + (1 << PAGE_SHIFT);
+    }
+    if (addr + size + (1 << PAGE_SHIFT) > VMALLOC_END || addr + size < addr)
+        return 0;
+
+    area->addr = addr;
+    area->size = size;
+    list_add_tail(&(area->list), pos);
+    return addr;
+}
+
+// unmap and free the pages of [addr, addr + size)
+static void unmap_vm_area(unsigned int addr, unsigned int size) {
+    unsigned int *pte;
+    unsigned int end = addr + size;
+
+    for (; addr < end; addr += (1 << PAGE_SHIFT)) {
+        pte = VMALLOC_PTE(addr);
+        if (!(*pte & ENTRYLO_V))
+            continue;
+        __free_pages(pages + (ENTRYLO_TO_PA(*pte) >> PAGE_SHIFT), 0);
+        *pte = ENTRYLO_G;
+        tlb_flush_page(addr);
+    }
+}
+
+/*
+ * allocate (size) bytes that are contiguous in kseg2, made of single pages
+ * from buddy, so it keeps working when no large block is left
+ * return 0 if either pages or window space is used up
+ */
+void *vmalloc(unsigned int size) {
+    struct vm_area *area;
+    struct page *page;
+    unsigned int old_ie;
+    unsigned int addr, va;
+
+    if (!size)
+        return 0;
+    size = (size + (1 << PAGE_SHIFT) - 1) & ~((1 << PAGE_SHIFT) - 1);
+
+    area = (struct vm_area *)kmalloc(sizeof(struct vm_area));
+    if (!area)
+        return 0;
+
+    old_ie = disable_interrupts();
+    addr = insert_vm_area(area, size);
+    if (old_ie)
+        enable_interrupts();
+    if (!addr) {
+        kfree(area);
+        return 0;
+    }
+
+    for (va = addr; va < addr + size; va += (1 << PAGE_SHIFT)) {
+        page = __alloc_pages(0);
+        if (!page) {
+            vfree((void *)addr);
+            return 0;
+        }
+        // a global mapping, it is the same in every address space
+        *VMALLOC_PTE(va) = ENTRYLO_PFN((page - pages) << PAGE_SHIFT) | ENTRYLO_CACHED | ENTRYLO_D | ENTRYLO_V | ENTRYLO_G;
+    }
+    return (void *)addr;
+}
+
+void vfree(void *addr) {
+    struct list_head *pos;
+    struct vm_area *area = 0;
+    unsigned int old_ie;
+
+    if (!addr)
+        return;
+
+    old_ie = disable_interrupts();
+    list_for_each(pos, &vm_areas) {
+        if (container_of(pos, struct vm_area, list)->addr == (unsigned int)addr) {
+            area = container_of(pos, struct vm_area, list);
+            list_del(&(area->list));
+            break;
+        }
+    }
+    if (old_ie)
+        enable_interrupts();
+
+    if (!area) {
+        kernel_printf("ERROR : vfree of %x, not a vmalloc area\n", (unsigned int)addr);
+        return;
+    }
+
+    // the area is off the list, so nothing can map over its pages meanwhile
+    unmap_vm_area(area->addr, area->size);
+    kfree(area);
+}
+
+/*
+ * page size of the next wired entry, at (off) bytes into the mapping of (pa) with (remain) left
+ * the largest one that pa and off are aligned to and the region fills both halves of,
+ * or that the region fills exactly one half of, which is then the last entry
+ */
+static unsigned int large_page_size(unsigned int pa, unsigned int off, unsigned int remain) {
+    unsigned int page_size;
+
+    for (page_size = LARGE_PAGE_MAX; page_size > (1 << PAGE_SHIFT); page_size >>= 2) {
+        if (!(pa & (page_size - 1)) && !(off & ((page_size << 1) - 1)) &&
+            ((page_size << 1) <= remain || page_size == remain))
+            break;
+    }
+    return page_size;
+}
+
+/*
+ * map the physically contiguous [pa, pa + size) into kseg2 with the largest page sizes
+ * (1MB, 256KB, 64KB, 16KB or 4KB) it can take, going down to smaller pages for the tail
+ * only size rounded up to 4KB is mapped: a last entry with one page left has its odd half
+ * invalid, (flags) gives the cache attribute and ENTRYLO_D
+ * e.g. vmap_large(GRAPHIC_VRAM_PA, GRAPHIC_VRAM_SIZE, ENTRYLO_UNCACHED | ENTRYLO_D) takes one entry
+ * return 0 if pa is not page aligned or not enough wired entries are left
+ */
+void *vmap_large(unsigned int pa, unsigned int size, unsigned int flags) {
+    unsigned int page_size, nr, first, i, off, va, lo1, old_ie;
+
+    if (!size || (pa & ((1 << PAGE_SHIFT) - 1)))
+        return 0;
+    size = (size + (1 << PAGE_SHIFT) - 1) & ~((1 << PAGE_SHIFT) - 1);
+    // no entry is larger than a slot, so nr entries fit in nr slots
+    for (nr = 0, off = 0; off < size; nr++)
+        off += large_page_size(pa + off, off, size - off) << 1;
+
+    old_ie = disable_interrupts();
+    // first run of nr free wired entries
+    for (first = 0; first + nr <= LARGEMAP_SLOTS; first++) {
+        for (i = 0; i < nr; i++) {
+            if (large_owner[first + i])
+                break;
+        }
+        if (i == nr)
+            break;
+    }
+    if (first + nr > LARGEMAP_SLOTS) {
+        if (old_ie)
+            enable_interrupts();
+        return 0;
+    }
+
+    va = LARGEMAP_START + first * LARGEMAP_SLOT;
+    flags |= ENTRYLO_V | ENTRYLO_G;
+    // a touch of the slots before left invalid 4KB entries from the refill handler,
+    // which would match together with the large one
+    tlb_flush_range(va, va + nr * LARGEMAP_SLOT);
+    for (i = 0, off = 0; i < nr; i++) {
+        page_size = large_page_size(pa + off, off, size - off);
+        // G stays set on an invalid odd half, see vmalloc_pgtable
+        lo1 = (page_size << 1) <= size - off ? ENTRYLO_PFN(pa + off + page_size) | flags : ENTRYLO_G;
+        large_owner[first + i] = va;
+        tlb_write_wired(TLB_WIRED_FIRST + first + i, va + off, ENTRYLO_PFN(pa + off) | flags, lo1,
+                        PAGEMASK(page_size));
+        off += page_size << 1;
+    }
+    if (old_ie)
+        enable_interrupts();
+    return (void *)va;
+}
+
+void vunmap_large(void *addr) {
+    unsigned int i, old_ie;
+
+    old_ie = disable_interrupts();
+    for (i = 0; i < LARGEMAP_SLOTS; i++) {
+        if (large_owner[i] && large_owner[i] == (unsigned int)addr) {
+            large_owner[i] = 0;
+            tlb_write_wired(TLB_WIRED_FIRST + i, 0x80000000 + ((TLB_WIRED_FIRST + i) << 13), 0, 0, PAGEMASK_4K);
+        }
+    }
+    if (old_ie)
+        enable_interrupts();
+}
+
+#define TLB_BENCH_ORDER 9  // 2MB, the size of the graphic VRAM
+#define TLB_BENCH_ROUNDS 4
+
+// read one word of every page of [addr, addr + size), return the refills it took
+static unsigned int tlb_bench_pass(unsigned int addr, unsigned int size, unsigned int *cycles) {
+    unsigned int round, va, refills, start, old_ie;
+    volatile unsigned int sum = 0;
+
+    old_ie = disable_interrupts();
+    refills = tlb_refills;
+    start = get_cp0_count();
+    for (round = 0; round < TLB_BENCH_ROUNDS; round++) {
+        for (va = addr; va < addr + size; va += (1 << PAGE_SHIFT))
+            sum += *(unsigned int *)va;
+    }
+    *cycles = get_cp0_count() - start;
+    refills = tlb_refills - refills;
+    if (old_ie)
+        enable_interrupts();
+    return refills;
+}
+
+// stream over 2MB mapped with 4KB pages by vmalloc, then with 1MB pages by vmap_large
+void tlb_bench() {
+    unsigned int size = (1 << PAGE_SHIFT) << TLB_BENCH_ORDER;
+    struct page *block;
+    void *small, *large;
+    unsigned int refills, cycles;
+
+    block = __alloc_pages(TLB_BENCH_ORDER);
+    small = vmalloc(size);
+    large = block ? vmap_large((block - pages) << PAGE_SHIFT, size, ENTRYLO_CACHED | ENTRYLO_D) : 0;
+    if (!small || !large) {
+        kernel_printf("Tlb-bench : out of memory\n");
+        goto out;
+    }
+
+    kernel_printf("Tlb-bench : %d rounds over %x bytes\n", TLB_BENCH_ROUNDS, size);
+    refills = tlb_bench_pass((unsigned int)small, size, &cycles);
+    kernel_printf("\t4KB pages : %d refills, %d cycles\n", refills, cycles);
+    refills = tlb_bench_pass((unsigned int)large, size, &cycles);
+    kernel_printf("\t1MB pages : %d refills, %d cycles\n", refills, cycles);
+
+out:
+    if (large)
+        vunmap_large(large);
+    if (block)
+        __free_pages(block, TLB_BENCH_ORDER);
+    if (small)
+        vfree(small);
+}
+
+void vmalloc_info() {
+    struct list_head *pos;
+    struct vm_area *area;
+    unsigned int i;
+
+    kernel_printf("Vmalloc : %x-%x\n", VMALLOC_START, VMALLOC_END - 1);
+    list_for_each(pos, &vm_areas) {
+        area = container_of(pos, struct vm_area, list);
+        kernel_printf("\t%x-%x : %x pages\n", area->addr, area->addr + area->size - 1, area->size >> PAGE_SHIFT);
+    }
+    kernel_printf("Large mappings :");
+    for (i = 0; i < LARGEMAP_SLOTS; i++)
+        kernel_printf(" %x", large_owner[i]);
+    kernel_printf("\n");
+}
@@ -1,8 +1,12 @@
 #include "pc.h"
 
+#include <arch.h>
 #include <driver/vga.h>
 #include <intr.h>
+#include <zjunix/slab.h>
 #include <zjunix/syscall.h>
+#include <zjunix/time.h>
+#include <zjunix/timer.h>
 #include <zjunix/utils.h>
 
 //所有进程链表
@@ -17,41 +21,62 @@ struct list_head sched[PRORITY_NUM + 1];
 unsigned int sched_time[PRORITY_NUM];
 //当前运行进程指针
 task_struct * current_task = 0;
+//优先级位图，第i位为1表示sched[i]非空，随进出调度链表增量维护
+unsigned int pro_map;
+//周期时钟次数，与当前周期内的count偏移共同构成调度时钟
+unsigned int sched_ticks = 0;
+//下一次周期时钟的count值，count从不复位，compare每次前进一个周期，处理延迟不累积
+unsigned int next_tick;
+//没有可运行的进程时停止周期时钟，由空进程设置
+int tick_stopped = 0;
+
+//切换到的寄存器现场，由pc_schedule设置，中断返回前start.s据此换栈
+context * switch_frame = 0;
+
+//停止周期时钟时最长的等待，使count差值保持在int范围内
+#define TICKLESS_MAX_CYCLES 0x40000000
+//compare至少设在当前count之后的周期数，避免设到已经过去的值
+#define COMPARE_MIN_CYCLES 100
+
+//设置compare，同时清除时钟中断
+static void set_compare(unsigned int count){
+    asm volatile("mtc0 %0, $11\n\t" : : "r"(count));
+}
+
+//将compare设为下一次周期时钟与下一个定时器到期中较早者，周期时钟停止时只看定时器
+//在关中断时调用
+void tick_program(){
+    unsigned int now = get_cp0_count();
+    unsigned int deadline;
+    unsigned int timer;
 
-// save context when doing context switch in interrupt
-static void copy_context(context* src, context* dest) {
-    dest->epc = src->epc;
-    dest->at = src->at;
-    dest->v0 = src->v0;
-    dest->v1 = src->v1;
-    dest->a0 = src->a0;
-    dest->a1 = src->a1;
-    dest->a2 = src->a2;
-    dest->a3 = src->a3;
-    dest->t0 = src->t0;
-    dest->t1 = src->t1;
-    dest->t2 = src->t2;
-    dest->t3 = src->t3;
-    dest->t4 = src->t4;
-    dest->t5 = src->t5;
-    dest->t6 = src->t6;
-    dest->t7 = src->t7;
-    dest->s0 = src->s0;
-    dest->s1 = src->s1;
-    dest->s2 = src->s2;
-    dest->s3 = src->s3;
-    dest->s4 = src->s4;
-    dest->s5 = src->s5;
-    dest->s6 = src->s6;
-    dest->s7 = src->s7;
-    dest->t8 = src->t8;
-    dest->t9 = src->t9;
-    dest->hi = src->hi;
-    dest->lo = src->lo;
-    dest->gp = src->gp;
-    dest->sp = src->sp;
-    dest->fp = src->fp;
-    dest->ra = src->ra;
+    deadline = tick_stopped ? now + TICKLESS_MAX_CYCLES : next_tick;
+    if(next_timer_count(&timer) && (int)(timer - deadline) < 0){
+        deadline = timer;
+    }
+    if((int)(deadline - now) < COMPARE_MIN_CYCLES){
+        deadline = now + COMPARE_MIN_CYCLES;
+    }
+    set_compare(deadline);
+}
+
+//补上错过的周期时钟并恢复周期时钟
+//停止周期时钟期间错过的周期一并计入sched_ticks
+static void tick_advance(){
+    unsigned int now = get_cp0_count();
+    unsigned int missed;
+    if((int)(now - next_tick) >= 0){
+        missed = (now - next_tick) / TIMER_CYCLES + 1;
+        sched_ticks += missed;
+        next_tick += missed * TIMER_CYCLES;
+    }
+    tick_stopped = 0;
+    tick_program();
+}
+
+//当前周期开始以来的count周期数
+static unsigned int tick_offset(){
+    return get_cp0_count() - (next_tick - TIMER_CYCLES);
 }
 
 //初始化所有进程链表
@@ -70,9 +95,7 @@ void init_pc_list(){
 
 //初始化优先级位图
 void init_pro_map(){
-    for(int i = 0; i < PRORITY_BYTES; i++){
-        pro_map[i] = 0;
-    }
+    pro_map = 0;
 }
 
 //将进程加入所有进程链表
@@ -92,6 +115,11 @@ void add_sched(task_struct * task){
     }
     else{
         list_add_tail(&(task->sched), &sched[index]);
+        pro_map |= 1u << index;
+        //有进程可运行，恢复周期时钟
+        if(tick_stopped){
+            tick_advance();
+        }
     }
 }
 
@@ -100,20 +128,6 @@ void add_wait(task_struct * task){
     list_add_tail(&(task->sched), &wait);
 }
 
-//将进程加入优先级位图
-void add_pro_map(task_struct * task){
-    int pro = task->dynamic_prority;
-    if(pro == -1){
-        return;
-    }
-    else{
-        int map_index = task->dynamic_prority >> 3;
-        int byte_index = task->dynamic_prority & 7;
-        pro_map[map_index] |= (1 << byte_index);
-        return;
-    }
-}
-
 //初始化进程管理，创建空进程
 //在init_kernel()中调用
 void init_pc(){
@@ -141,7 +155,7 @@ void init_pc(){
     idle->counter = MAX_TIMESLICE;
     kernel_strcpy(idle->start_time, "00:00:00");
     idle->sleep_avg = 0;
-    idle->is_changed = 0;
+    sched_stamp(idle);
     
     //当前寄存器的内容即为空进程的寄存器内容无需赋值
 
@@ -157,12 +171,12 @@ void init_pc(){
 
     //注册进程调度函数，时钟中断触发
     register_interrupt_handler(7, pc_schedule);
-    //设置cp0中的compare和count寄存器
+    //定时器时间轮
+    init_timers();
+    //设置cp0中的compare寄存器，count继续计数
     //当compare == count时，产生时钟中断（7号）
-    asm volatile(
-        "li $v0, 10000000\n\t"
-        "mtc0 $v0, $11\n\t"
-        "mtc0 $zero, $9");
+    next_tick = get_cp0_count() + TIMER_CYCLES;
+    set_compare(next_tick);
 
 }
 
@@ -171,6 +185,7 @@ void init_pc(){
 //entry: 进程的入口函数
 //argv: 进程的参数信息
 //ret_pid：用于返回新创建进程的PID
+//is_user：用户进程，地址空间为当前进程的写时复制副本，当前进程没有地址空间时为空
 //创建成功返回0，否则返回1
 int task_create(char * task_name, long static_prority, void (*entry)(unsigned int argc, void * argv),
                 unsigned int argc, void * argv, pid_t * ret_pid, int is_user){
@@ -187,9 +202,9 @@ int task_create(char * task_name, long static_prority, void (*entry)(unsigned in
         return 1;
     }
 
-    //创建task_union结构
+    //创建task_union结构，清零的页来自空进程预先清零的页池
     task_union * new_union;
-    new_union = (union task_union*)kmalloc(sizeof(task_union));
+    new_union = (union task_union*)kzalloc(sizeof(task_union));
     if(new_union == 0){
         kernel_printf("Task_create: task_union allocated failed\n");
         if(pid_free(new_pid)){
@@ -225,32 +240,46 @@ int task_create(char * task_name, long static_prority, void (*entry)(unsigned in
     get_time(temp_time, START_TIME_LEN);
     kernel_strcpy(new_union->task.start_time, temp_time);
     new_union->task.sleep_avg = 0;
-    new_union->task.is_changed = 0;
+    sched_stamp(&(new_union->task));
 
-    //寄存器初始化
-    kernel_memset(&(new_union->task.context), 0, sizeof(context));
+    //在内核栈顶构造初始寄存器现场，首次被调度时从该现场返回到入口函数
+    //寄存器已由kzalloc清零
+    context * frame = (context *)((unsigned int)new_union + KERNEL_STACK_SIZE - sizeof(context));
     //新进程入口地址
-    new_union->task.context.epc = (unsigned int)entry;
+    frame->epc = (unsigned int)entry;
     //新进程内核栈指针
-    new_union->task.context.sp = (unsigned int)new_union + KERNEL_STACK_SIZE;
+    frame->sp = (unsigned int)new_union + KERNEL_STACK_SIZE;
     //设置全局指针
     unsigned int init_gp;
     asm volatile("la %0, _gp\n\t" : "=r"(init_gp));
-    new_union->task.context.gp = init_gp;
+    frame->gp = init_gp;
     //设置新进程参数
-    new_union->task.context.a0 = argc;
-    new_union->task.context.a1 = (unsigned int)argv;
+    frame->a0 = argc;
+    frame->a1 = (unsigned int)argv;
+    new_union->task.frame = frame;
 
     INIT_LIST_HEAD(&(new_union->task.sched));
     INIT_LIST_HEAD(&(new_union->task.list));
 
-    //用户进程空间结构
-    //if(is_user){
-        //new_union->task.mm = mm_create();
-    //}
-    //else{
+    //用户进程空间结构，TLB项以ASID区分
+    if(is_user){
+        if(current_task->mm != 0){
+            //与当前进程共享页面，任一方首次写入时复制
+            new_union->task.mm = mm_dup(current_task->mm, new_union->task.ASID);
+        }
+        else{
+            new_union->task.mm = mm_create(new_union->task.ASID);
+        }
+        if(new_union->task.mm == 0){
+            kernel_printf("Task_create: mm created failed\n");
+            kfree(new_union);
+            pid_free(new_pid);
+            return 1;
+        }
+    }
+    else{
         new_union->task.mm = 0;
-    //}
+    }
     //打开文件链表
     //new_union->task.files = 0;
 
@@ -262,7 +291,6 @@ int task_create(char * task_name, long static_prority, void (*entry)(unsigned in
     //加入进程链表
     add_tasks(&(new_union->task));
     add_sched(&(new_union->task));
-    add_pro_map(&(new_union->task));
     new_union->task.state = TASK_READY;
     return 0;
 }
@@ -282,9 +310,14 @@ void remove_tasks(task_struct * task){
 }
 
 //从优先级调度链表中移除进程
+//该优先级链表变空则清除位图中对应位，进程在等待链表中时位图不变
 void remove_sched(task_struct * task){
+    int index = task->dynamic_prority;
     list_del(&(task->sched));
     INIT_LIST_HEAD(&(task->sched));
+    if(index >= 0 && index < PRORITY_NUM && list_empty(&sched[index])){
+        pro_map &= ~(1u << index);
+    }
 }
 
 //清理终结链表
@@ -313,143 +346,67 @@ void clear_terminal(){
     return;
 }
 
-//更新平均睡眠时间
-//在updata_dynamic_prority()中调用
-void update_sleep_avg(){
-    int sleep_time = (current_task->dynamic_prority + 1) * MIN_TIMESLICE;
-    //遍历优先级调度链表，跟新平均睡眠时间
-    struct list_head *pos;
-    task_struct *next;
-    for(int i = 0; i < PRORITY_NUM; i++){
-        //和当前进程不在同一优先级
-        if(i != current_task->dynamic_prority){
-            list_for_each(pos, &sched[i]){
-                next = container_of(pos, task_struct, sched);
-                next->sleep_avg += sleep_time;
-            }
-        }
-        //和当前进程属于同一优先级
-        else{
-            list_for_each(pos, &sched[i]){
-                next = container_of(pos, task_struct, sched);
-                //不是当前进程则增加睡眠时间
-                if(next != current_task){
-                    next->sleep_avg += sleep_time;
-                }
-                //是当前进程则减少睡眠时间
-                else{
-                    next->sleep_avg -= sleep_time;
-                }
-            }
-        }
-    }
+//记录进程进出运行、进出调度链表的时间戳
+void sched_stamp(task_struct * task){
+    task->stamp_ticks = sched_ticks;
+    task->stamp_count = tick_offset();
 }
 
-//计算链表节点个数
-int count_list(struct list_head * head){
-    int count = 0;
-    struct list_head * pos;
-    //遍历链表
-    list_for_each(pos, head){
-        count++;
-    }
-    return count;
+//距进程时间戳经过的时间片数
+static int ticks_since(task_struct * task){
+    return (int)(sched_ticks - task->stamp_ticks) + ((int)tick_offset() - (int)task->stamp_count) / (int)TIMER_CYCLES;
 }
 
-//根据平均睡眠时间更新动态优先级
-//当前执行进程睡眠时间减少，其他进程睡眠时间增加，init和idle不变
-void update_dynamic_prority(){
-
-    //更新平均睡眠时间
-    update_sleep_avg();
-
-    struct list_head * pos;
-    task_struct * next;
-    
-    //根据平均睡眠时间修改动态优先级
-    for(int i = 0; i < PRORITY_NUM; i++){
-        int num = count_list(&sched[i]);
-        struct list_head * temp = sched[i].next;
-        while(num){
-            num--;
-            pos = temp;
-            temp = temp->next;
-            next = container_of(pos, task_struct, sched);
-            //当前进程不变
-            if(next != current_task){
-                remove_sched(next);
-                //已经过变化则不再变化
-                if(!next->is_changed){
-                    // #ifdef PC_DEBUG
-                    //     kernel_printf("Update_d_prority: pre_prority: %d with pid = %d\n", next->dynamic_prority, next->pid);
-                    // #endif
-                    int temp = next->dynamic_prority;
-                    next->dynamic_prority += next->sleep_avg / (PRORITY_NUM * MIN_TIMESLICE);
-                    if(next->dynamic_prority >= PRORITY_NUM){
-                        next->dynamic_prority = PRORITY_NUM - 1;
-                    }
-                    else if(next->dynamic_prority < 0){
-                        next->dynamic_prority = 0;
-                        //next->sleep_avg = 0;
-                    }
-                    next->counter = sched_time[next->dynamic_prority];
-                    next->is_changed = 1;
-
-                    // #ifdef PC_DEBUG
-                    //     kernel_printf("Update_d_prority: new_prority: %d with pid = %d\n", next->dynamic_prority, next->pid);
-                    // #endif
-                    #ifdef PC_DEBUG
-                        int new = next->dynamic_prority;
-                        if(temp != new){
-                            kernel_printf("task pid = %d: pre_prority = %d -> new_prority = %d\n", next->pid, temp, new);
-                        }
-                    #endif
-                }
-                add_sched(next);
-            }
-        }
+//根据时间戳更新平均睡眠时间，只涉及状态改变的进程，与进程总数无关
+//在调度链表和等待链表中的时间计入，运行的时间扣除，单位为时间片
+//在进程开始运行或被唤醒(is_run = 0)和停止运行(is_run = 1)时调用
+void update_sleep_avg(task_struct * task, int is_run){
+    int ticks = ticks_since(task);
+    if(is_run){
+        task->sleep_avg -= ticks;
+    }
+    else{
+        task->sleep_avg += ticks;
     }
+    sched_stamp(task);
 }
 
-//更新优先级位图
-void update_pro_map(){
-
-    //初始化位图
-    init_pro_map();
+//根据平均睡眠时间更新动态优先级
+//进程此时不在调度链表中，init和idle不变
+//时间片不在这里补满，只在用完时由find_next_task补满
+void update_dynamic_prority(task_struct * task){
+    #ifdef PC_DEBUG
+        int temp = task->dynamic_prority;
+    #endif
+    task->dynamic_prority += task->sleep_avg / (PRORITY_NUM * MIN_TIMESLICE);
+    if(task->dynamic_prority >= PRORITY_NUM){
+        task->dynamic_prority = PRORITY_NUM - 1;
+    }
+    else if(task->dynamic_prority < 0){
+        task->dynamic_prority = 0;
+    }
 
-    task_struct * next;
-    for(int i = 0; i < PRORITY_NUM; i++){
-        if(sched[i].next != &sched[i]){
-            next = container_of(sched[i].next, task_struct, sched);
-            add_pro_map(next);
+    #ifdef PC_DEBUG
+        int new = task->dynamic_prority;
+        if(temp != new){
+            kernel_printf("task pid = %d: pre_prority = %d -> new_prority = %d\n", task->pid, temp, new);
         }
-    }
+    #endif
 }
 
-//更新是否变化
-void update_is_changed(){
-    struct list_head * pos;
-    task_struct * next;
-    
-    //遍历所有进程链表
-    list_for_each(pos, &tasks){
-        next = container_of(pos, task_struct, list);
-        next->is_changed = 0;
-    }
+//前导零个数，MIPS32的clz指令
+static unsigned int clz(unsigned int x){
+    unsigned int n;
+    asm volatile("clz %0, %1" : "=r"(n) : "r"(x));
+    return n;
 }
 
 //在优先级位图中寻找最高优先级进程
+//最高的非空优先级即位图最高的1位，一条clz指令得到，与进程数无关
 task_struct * find_in_pro_map(){
     task_struct * next;
-    int i;
-    for(i = PRORITY_NUM - 1; i >= 0; i--){
-        int map_index = i >> 3;
-        int byte_index = i & 7;
-        if(pro_map[map_index] & (1 << byte_index)){
-            break;
-        }
-    }
-    //优先级链表无进程返回空进程
+    int i = 31 - (int)clz(pro_map);
+    //优先级链表无进程返回空进程，clz(0) = 32
     if(i < 0){
         next = container_of(sched[PRORITY_NUM].next, task_struct, sched);
     }
@@ -474,43 +431,14 @@ task_struct * find_next_task(){
     else if(current_task->dynamic_prority == -1 && current_task->sched.next != &sched[PRORITY_NUM]){
         next = container_of(current_task->sched.next, task_struct, sched);
     }
-    //优先级进程
+    //优先级进程，时间片已用完，扣除本次运行时间，更新其动态优先级并补满时间片
     else{
         remove_sched(current_task);
-        //已经过变化则不再变化
-        if(!current_task->is_changed){
-            int temp = current_task->dynamic_prority;
-            // #ifdef PC_DEBUG
-            //     kernel_printf("Update_d_prority: pre_prority: %d with pid = %d\n", current_task->dynamic_prority, current_task->pid);
-            // #endif
-            current_task->dynamic_prority += current_task->sleep_avg / (PRORITY_NUM * MIN_TIMESLICE);
-            if(current_task->dynamic_prority >= PRORITY_NUM){
-                current_task->dynamic_prority = PRORITY_NUM - 1;
-            }
-            else if(current_task->dynamic_prority < 0){
-                current_task->dynamic_prority = 0;
-                //current_task->sleep_avg = 0;
-            }
-            current_task->counter = sched_time[current_task->dynamic_prority];
-            current_task->is_changed = 1;
-            // #ifdef PC_DEBUG
-            //     kernel_printf("Update_d_prority: new_prority: %d with pid = %d\n", current_task->dynamic_prority, current_task->pid);
-            // #endif
-
-            #ifdef PC_DEBUG
-                int new = current_task->dynamic_prority;
-                if(temp != new){
-                    kernel_printf("task pid = %d: pre_prority = %d -> new_prority = %d\n", current_task->pid, temp, new);
-                }
-            #endif
-        }
+        update_sleep_avg(current_task, 1);
+        update_dynamic_prority(current_task);
+        current_task->counter = sched_time[current_task->dynamic_prority];
         add_sched(current_task);
 
-        //更新优先级位图
-        update_pro_map();
-        //更新是否改变优先级
-        update_is_changed();
-
         next = container_of(sched[PRORITY_NUM].next, task_struct, sched);
     }
     if(is_back == 1){
@@ -519,6 +447,24 @@ task_struct * find_next_task(){
     return next;
 }
 
+//当前进程阻塞或退出时选取下一个进程，调用者再将其放入等待链表或终结链表
+//扣除本次运行时间并移出调度链表，下一进程直接由位图得到，没有可运行的进程时为空进程
+//不同于find_next_task，不会先换到空进程再由其调度
+//剩余的时间片保留，唤醒后接着用，反复睡眠的进程不会借此一直补满时间片
+static task_struct * find_next_blocked(){
+    remove_sched(current_task);
+    if(current_task->dynamic_prority != -1){
+        update_sleep_avg(current_task, 1);
+    }
+    return find_in_pro_map();
+}
+
+//切换到进程的地址空间，EntryHi写入进程的ASID
+//内核线程没有用户地址空间，只写入ASID
+void activate_mm(task_struct * task){
+    mm_switch(task->mm, task->ASID);
+}
+
 //进程调度函数，由时钟中断触发
 //参数pt_context指向当前进程的上下文信息
 void pc_schedule(unsigned int status, unsigned int cause, context * pt_context){
@@ -527,6 +473,14 @@ void pc_schedule(unsigned int status, unsigned int cause, context * pt_context){
     // #endif
 
     task_struct * next;
+
+    //运行到期的定时器，被唤醒的进程加入调度链表
+    run_timers();
+    //周期时钟未到，只是定时器到期：空进程立即让给被唤醒的进程，其他进程继续运行
+    if(!tick_stopped && (int)(get_cp0_count() - next_tick) < 0 && current_task->dynamic_prority != -1){
+        goto end;
+    }
+
     //若非idle、init进程则更改时间片数量
     if(current_task->dynamic_prority != -1){
         current_task->counter--;
@@ -543,10 +497,7 @@ void pc_schedule(unsigned int status, unsigned int cause, context * pt_context){
             //清理终结链表
             clear_terminal();
 
-            //更新动态优先级
-            update_dynamic_prority();
-
-            //调用调度算法，选取下一个要运行的进程
+            //调用调度算法，同时更新当前进程的动态优先级，选取下一个要运行的进程
             next = find_next_task();
         }
     }
@@ -559,22 +510,22 @@ void pc_schedule(unsigned int status, unsigned int cause, context * pt_context){
 
     //如果选取的进程不是当前进程
     if(next != current_task){
-        // if(next->mm != 0){
-        //     activate_mm(next);
-        // }
+        //切换地址空间和ASID，无需刷新TLB
+        activate_mm(next);
 
-        //保存当前进程上下文
-        copy_context(pt_context, &(current_task->context));
+        //寄存器现场已保存在当前进程的内核栈上，只记录其位置
+        current_task->frame = pt_context;
         current_task->state = TASK_READY;
         current_task = next;
-        //加载下一进程上下文
-        copy_context(&(current_task->context), pt_context);
+        //中断返回时换到下一进程的现场，计入其等待时间
+        switch_frame = current_task->frame;
+        kernel_sp = (unsigned int)current_task + KERNEL_STACK_SIZE;
+        update_sleep_avg(current_task, 0);
         current_task->state = TASK_RUNNING;
         goto end;
     }    
+    //没有其他可运行的进程，空进程继续运行
     else{
-        kernel_printf("PC_schedule: next == current_task\n");
-        while(1);
         goto end;
     }
 
@@ -582,8 +533,26 @@ end:
     // #ifdef PC_DEBUG
     //     kernel_printf("PC_shcedule: next_pid = %d\n", current_task->pid);
     // #endif
-    //将cp0中到count寄存器复位为0，结束时钟中断
-    asm volatile("mtc0 $zero, $9\n\t");
+    //compare前进到下一次周期时钟或定时器到期，结束时钟中断，count不复位
+    tick_advance();
+}
+
+//空进程无事可做时调用
+//没有可运行的进程时停止周期时钟，compare设为下一个定时器的到期时间，用wait指令等待中断
+//中断处理中若有进程变为可运行，add_sched恢复周期时钟，时钟中断时切换过去
+//检查到wait之间一直关中断：其间到来的中断保持挂起，不会在检查之后被处理而使wait睡过头
+//依赖处理器在IE为0时遇到挂起的中断也退出wait，开中断后再进入中断处理
+void pc_idle(){
+    unsigned int old_ie = disable_interrupts();
+    if(pro_map == 0){
+        tick_stopped = 1;
+        //定时器可能在上次等待后加入或到期，重新设置compare
+        tick_program();
+        asm volatile("wait\n\t");
+    }
+    if(old_ie){
+        enable_interrupts();
+    }
 }
 
 //打印进程结构信息
@@ -709,13 +678,13 @@ int pc_kill(pid_t pid){
     //     task_files_delete(task);
     // }
 
-    // if(task->mm != 0){
-    //     mm_delete(task->mm);
-    // }
+    if(task->mm != 0){
+        mm_delete(task->mm);
+        task->mm = 0;
+    }
 
     //释放pid
     pid_free(pid);
-    update_pro_map();
     enable_interrupts();
     return 0;
 }
@@ -773,19 +742,10 @@ int kernel_proc(unsigned int argc, void * argv){
         while(1);
     }
 
-    //循环计数输出进程的动态优先级
-    int cnt1 = 0;
-    int cnt2 = 0;
-    while(1){
-        cnt1++;
-        if(cnt2 == 3){
-            break;
-        }
-        if(cnt1 == 10000000){
-            kernel_printf("\ncurrent_task: %d with d_prority: %d\n", current_task->pid, current_task->dynamic_prority);
-            cnt1 = 0;
-            cnt2++;
-        }
+    //每秒输出一次进程的动态优先级，共三次，睡眠期间不占用处理器
+    for(int cnt = 0; cnt < 3; cnt++){
+        msleep(1000);
+        kernel_printf("\ncurrent_task: %d with d_prority: %d\n", current_task->pid, current_task->dynamic_prority);
     }
     //进程结束
     kernel_printf("\ncurrent_task: %d with d_prority: %d ending......\n", current_task->pid, current_task->dynamic_prority);
@@ -823,10 +783,8 @@ int exec_kernel(void * argv, int is_wait, int is_user){
 
     kernel_printf("s_prority = %d\n", s_prority);
 
-    if(!is_user){
-        //内核线程，新进程入口为kernel_proc函数
-        res = task_create(name, s_prority, (void *)kernel_proc, 1, name, &new_pid, 0);
-    }
+    //新进程入口为kernel_proc函数，用户进程另有写时复制的地址空间
+    res = task_create(name, s_prority, (void *)kernel_proc, 1, name, &new_pid, is_user);
     if(res != 0){
         kernel_printf("Exec_kernel: task created failed!\n");
         return 1;
@@ -856,9 +814,10 @@ void task_exit(){
     // if(current_task->files != 0){
     //     task_files_delete(current_task);
     // }
-    // if(current_task->mm != 0){
-    //     mm_delete(current_task->mm);
-    // }
+    if(current_task->mm != 0){
+        mm_delete(current_task->mm);
+        current_task->mm = 0;
+    }
 
     //中断关闭
     asm volatile (      
@@ -873,45 +832,53 @@ void task_exit(){
 
     //唤醒父进程函数
     wakeup_parent();
-    
-    //更新动态优先级
-    update_dynamic_prority();
-
-    //更新优先级位图
-    update_pro_map();
-    //更新是否改变优先级
-    update_is_changed();
 
     #ifdef PC_DEBUG
         kernel_printf("PC_exit: prepare to find next task\n");
     #endif
 
-    //调用调度算法，选取下一个要运行的进程
+    //移出调度链表，选取下一个要运行的进程
     task_struct * next;
-    next = find_next_task();
+    next = find_next_blocked();
     
     #ifdef PC_DEBUG
         kernel_printf("PC_exit: next task pid = %d\n", next->pid);
     #endif
 
-    // if(next->mm != 0){
-    //     activate_mm(next);
-    // }
+    activate_mm(next);
 
-    remove_sched(current_task);
     add_terminal(current_task);
     pid_free(current_task->pid);
-    //更新优先级位图
-    update_pro_map();
     current_task = next;
+    kernel_sp = (unsigned int)current_task + KERNEL_STACK_SIZE;
+    update_sleep_avg(current_task, 0);
 
     //调用汇编代码，加载新的进程上下文信息
-    switch_ex(&(current_task->context));
+    switch_ex(current_task->frame);
 
     //进程退出完成，将不会进行到这里
     kernel_printf("Task_exit: error!");
 }
 
+//将等待链表中的进程放回调度链表
+//阻塞的时间计入平均睡眠时间，按新的动态优先级加入，不必等到下次运行后才得到提升
+//剩余时间片超过新优先级的时间片时截短
+static void wake_task(task_struct * task){
+    remove_sched(task);
+    if(task->dynamic_prority != -1){
+        update_sleep_avg(task, 0);
+        update_dynamic_prority(task);
+        if(task->counter > sched_time[task->dynamic_prority]){
+            task->counter = sched_time[task->dynamic_prority];
+        }
+    }
+    else{
+        sched_stamp(task);
+    }
+    add_sched(task);
+    task->state = TASK_READY;
+}
+
 //唤醒父进程
 //如果父进程处于等待队列，则将其从中删除并加入调度队列
 void wakeup_parent(){
@@ -927,10 +894,99 @@ void wakeup_parent(){
     
     //父进程在等待
     if(parent != 0){
-        remove_sched(parent);
-        add_sched(parent);
-        add_pro_map(parent);
-        parent->state = TASK_READY;
+        wake_task(parent);
+    }
+}
+
+//唤醒因schedule_timeout睡眠的进程，进程不在睡眠时不做处理
+void wake_up_process(task_struct * task){
+    unsigned int old_ie = disable_interrupts();
+    if(task->state == TASK_WAITING){
+        wake_task(task);
+    }
+    if(old_ie){
+        enable_interrupts();
+    }
+}
+
+//定时器到期，唤醒睡眠的进程
+static void process_timeout(unsigned int data){
+    wake_up_process((task_struct *)data);
+}
+
+//当前进程睡眠timeout毫秒：放入等待链表，不占用处理器，到期由定时器唤醒
+//调用前先将current_task->state置为TASK_WAITING，再检查所等待的条件
+//其间到来的wake_up_process将状态改回，这里不再睡眠，唤醒不会丢失
+//返回剩余的毫秒数，被wake_up_process提前唤醒时不为0
+//空进程及调度开始前不能睡眠，此时等待时钟到达
+unsigned int schedule_timeout(unsigned int timeout){
+    struct timer_list timer;
+    task_struct * prev;
+    task_struct * next;
+
+    update_jiffies();
+    init_timer(&timer);
+    timer.expires = jiffies + timeout;
+    timer.function = process_timeout;
+    timer.data = (unsigned int)current_task;
+
+    if(current_task == 0 || current_task->pid == IDLE_PID){
+        if(current_task != 0){
+            current_task->state = TASK_RUNNING;
+        }
+        while((int)(timer.expires - jiffies) > 0){
+            update_jiffies();
+        }
+        return 0;
+    }
+
+    disable_interrupts();
+    //已被唤醒
+    if(current_task->state != TASK_WAITING){
+        enable_interrupts();
+        return timeout;
+    }
+    add_timer(&timer);
+    //置EXL位后开中断，EXL屏蔽中断直到switch_wa中的eret
+    asm volatile (
+        "mfc0  $t0, $12\n\t"
+        "ori   $t0, $t0, 0x02\n\t"
+        "mtc0  $t0, $12\n\t"
+        "nop\n\t"
+        "nop\n\t"
+    );
+    enable_interrupts();
+
+    //将当前进程从调度链表中移除，选取下一个要运行的进程
+    next = find_next_blocked();
+    activate_mm(next);
+    //放入等待链表
+    add_wait(current_task);
+
+    prev = current_task;
+    current_task = next;
+    kernel_sp = (unsigned int)current_task + KERNEL_STACK_SIZE;
+    update_sleep_avg(current_task, 0);
+    switch_wa(next->frame, &(prev->frame));
+
+    //被唤醒从这里执行
+    del_timer(&timer);
+    update_jiffies();
+    if((int)(timer.expires - jiffies) > 0){
+        return timer.expires - jiffies;
+    }
+    return 0;
+}
+
+//睡眠至少ms毫秒，不占用处理器
+void msleep(unsigned int ms){
+    //当前这一毫秒已经过去一部分
+    unsigned int timeout = ms + 1;
+    while(timeout){
+        if(current_task != 0){
+            current_task->state = TASK_WAITING;
+        }
+        timeout = schedule_timeout(timeout);
     }
 }
 
@@ -966,39 +1022,28 @@ void wait_pid(pid_t pid){
     #ifdef PC_DEBUG
         kernel_printf("Wait_pid: current_pid = %d wait_pid = %d\n", current_task->pid, pid);
     #endif
-    //更新动态优先级
-    update_dynamic_prority();
-
-    //更新优先级位图
-    update_pro_map();
-    //更新是否改变优先级
-    update_is_changed();
-
     #ifdef PC_DEBUG
         kernel_printf("Wait_pid: prepare to find next task\n");
     #endif
-    //调用调度算法，选取下一个要运行的进程
+    //将当前进程从调度链表中移除，选取下一个要运行的进程
     task_struct * next_sched;
-    next_sched = find_next_task();
+    next_sched = find_next_blocked();
     
     //激活地址空间
-    // if(next_sched->mm != 0){
-    //     activate_mm(next);
-    // }
+    activate_mm(next_sched);
     #ifdef PC_DEBUG
         kernel_printf("Wait_pid: next task pid = %d\n", next->pid);
     #endif
-    //将当前进程从调度链表中移除，放入等待链表
-    remove_sched(current_task);
-    //更新优先级位图
-    update_pro_map();
+    //放入等待链表
     add_wait(current_task);
 
     //加载新进程的上下文信息
     task_struct * curr_sched;
     curr_sched = current_task;
     current_task = next_sched;
-    switch_wa(&(next_sched->context), &(curr_sched->context));
+    kernel_sp = (unsigned int)current_task + KERNEL_STACK_SIZE;
+    update_sleep_avg(current_task, 0);
+    switch_wa(next_sched->frame, &(curr_sched->frame));
 
     //被唤醒从这里执行
     kernel_printf("Wait_pid: task wake with pid = %d\n", current_task->pid);
@@ -1019,3 +1064,67 @@ task_struct * wait_check(pid_t pid){
     }
     return ret;
 }
+
+//直接切换到进程task，不经过调度算法，用于切换开销测试
+static void switch_to(task_struct * task){
+    task_struct * prev = current_task;
+
+    //置EXL位，由switch_wa中的eret清除
+    asm volatile (
+        "mfc0  $t0, $12\n\t"
+        "ori   $t0, $t0, 0x02\n\t"
+        "mtc0  $t0, $12\n\t"
+        "nop\n\t"
+        "nop\n\t"
+    );
+    activate_mm(task);
+    current_task = task;
+    kernel_sp = (unsigned int)current_task + KERNEL_STACK_SIZE;
+    switch_wa(task->frame, &(prev->frame));
+}
+
+#define SWITCH_BENCH_ROUNDS 1000
+static task_struct * bench_ping;
+
+//乒乓测试的另一方，每次被切换到后立即切换回测试进程
+static void switch_bench_pong(unsigned int argc, void * argv){
+    while(1){
+        switch_to(bench_ping);
+    }
+}
+
+//进程切换开销测试：当前进程与pong进程来回切换SWITCH_BENCH_ROUNDS次
+//关中断进行，时钟中断不会打断计数
+void switch_bench(){
+    task_struct * pong;
+    pid_t pong_pid;
+    unsigned int old_ie, start, end;
+
+    //先设好bench_ping并关中断，pong在移出调度队列前不会被时钟中断调度到
+    bench_ping = current_task;
+    old_ie = disable_interrupts();
+    if(task_create("pong", 0, switch_bench_pong, 0, 0, &pong_pid, 0)){
+        if(old_ie){
+            enable_interrupts();
+        }
+        kernel_printf("Switch_bench: task created failed!\n");
+        return;
+    }
+
+    //pong只由switch_to切换到，不参与调度
+    pong = find_in_tasks(pong_pid);
+    remove_sched(pong);
+
+    start = get_cp0_count();
+    for(int i = 0; i < SWITCH_BENCH_ROUNDS; i++){
+        switch_to(pong);
+    }
+    end = get_cp0_count();
+    if(old_ie){
+        enable_interrupts();
+    }
+
+    kernel_printf("Switch_bench: %d round trips, %d cycles per switch\n", SWITCH_BENCH_ROUNDS,
+                  (end - start) / (2 * SWITCH_BENCH_ROUNDS));
+    pc_kill(pong_pid);
+}
@@ -1,7 +1,19 @@
-
 #include <arch.h>
+#include <driver/vga.h>
 #include <zjunix/syscall.h>
+#include <zjunix/vm.h>
 
+// print the string at a0, a user string is read through kseg0 as this runs with status.EXL set
 void syscall4(unsigned int status, unsigned int cause, context* pt_context) {
-    kernel_puts((unsigned char*)pt_context->a0,0xfff,0);
-}
\ No newline at end of file
+    unsigned int s = pt_context->a0;
+    unsigned char* c;
+
+    if (s >= USER_SPACE_END) {
+        kernel_puts((unsigned char*)s, 0xfff, 0);
+        return;
+    }
+    while ((c = (unsigned char*)user_kva(s)) && *c) {
+        kernel_putchar(*c, 0xfff, 0);
+        s++;
+    }
+}
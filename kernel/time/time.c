@@ -49,6 +49,8 @@ void system_time_proc() {
             kernel_putchar_at(day[i], 0xfff, 0, 29, 61 + i);
         for (i = 0; i < 8; i++)
             kernel_putchar_at(buffer[i], 0xfff, 0, 29, 72 + i);
+        // the clock shows seconds, sleep instead of repainting it all the time
+        msleep(500);
     }
 }
 
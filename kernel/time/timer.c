@@ -0,0 +1,231 @@
+#include <arch.h>
+#include <intr.h>
+#include <zjunix/pc.h>
+#include <zjunix/timer.h>
+#include <zjunix/utils.h>
+
+/*
+ * hierarchical timer wheel: tv1 holds one list per jiffy of the next TVR_SIZE jiffies,
+ * each level of tvn one list per TVR_SIZE * TVN_SIZE^level jiffies beyond that
+ * a list of tvn is cascaded down a level whenever the lower level wraps,
+ * so adding, deleting and running a timer never walks other timers
+ */
+#define TVR_BITS 8
+#define TVN_BITS 6
+#define TVR_SIZE (1 << TVR_BITS)
+#define TVN_SIZE (1 << TVN_BITS)
+#define TVR_MASK (TVR_SIZE - 1)
+#define TVN_MASK (TVN_SIZE - 1)
+#define TVN_LEVELS 4  // TVR_BITS + TVN_LEVELS * TVN_BITS = 32
+
+#define TVN_INDEX(jiffy, level) (((jiffy) >> (TVR_BITS + (level)*TVN_BITS)) & TVN_MASK)
+
+static struct list_head tv1[TVR_SIZE];
+static struct list_head tvn[TVN_LEVELS][TVN_SIZE];
+/*
+ * one bit per list of tv1, set when a timer is put there and cleared when the list runs,
+ * the first list is the most significant bit of the first word, so that clz finds the next one
+ * a deleted timer leaves its bit set, the list is then found empty when its jiffy comes
+ */
+static unsigned int tv1_map[TVR_SIZE >> 5];
+
+unsigned int jiffies;
+// the first jiffy whose timers have not run yet
+static unsigned int timer_jiffies;
+// CP0 count at the start of the current jiffy
+static unsigned int jiffies_count;
+static unsigned int nr_timers;
+
+void init_timers() {
+    unsigned int i, j;
+
+    for (i = 0; i < TVR_SIZE; i++)
+        INIT_LIST_HEAD(tv1 + i);
+    for (i = 0; i < (TVR_SIZE >> 5); i++)
+        tv1_map[i] = 0;
+    for (i = 0; i < TVN_LEVELS; i++) {
+        for (j = 0; j < TVN_SIZE; j++)
+            INIT_LIST_HEAD(tvn[i] + j);
+    }
+    jiffies = 0;
+    timer_jiffies = 0;
+    jiffies_count = get_cp0_count();
+    nr_timers = 0;
+}
+
+// bring jiffies up to CP0 count, count must not have run 2^32 cycles since the last call
+void update_jiffies() {
+    unsigned int elapsed;
+    unsigned int old_ie;
+
+    old_ie = disable_interrupts();
+    elapsed = (get_cp0_count() - jiffies_count) / COUNT_PER_MS;
+    jiffies += elapsed;
+    jiffies_count += elapsed * COUNT_PER_MS;
+    if (old_ie)
+        enable_interrupts();
+}
+
+void init_timer(struct timer_list *timer) {
+    INIT_LIST_HEAD(&(timer->list));
+}
+
+unsigned int timer_pending(struct timer_list *timer) {
+    return !list_empty(&(timer->list));
+}
+
+static unsigned int clz(unsigned int x) {
+    unsigned int n;
+    asm volatile("clz %0, %1" : "=r"(n) : "r"(x));
+    return n;
+}
+
+// the first list of tv1 from (index) on that may hold timers, TVR_SIZE if there is none
+static unsigned int tv1_next(unsigned int index) {
+    unsigned int word = index >> 5;
+    unsigned int bits = tv1_map[word] & (0xffffffff >> (index & 31));
+
+    while (!bits) {
+        if (++word == (TVR_SIZE >> 5))
+            return TVR_SIZE;
+        bits = tv1_map[word];
+    }
+    return (word << 5) + clz(bits);
+}
+
+// put (timer) on the list of its expiry, interrupts must be off
+static void internal_add_timer(struct timer_list *timer) {
+    unsigned int expires = timer->expires;
+    unsigned int idx = expires - timer_jiffies;
+    unsigned int level;
+    struct list_head *vec;
+
+    if ((int)idx < 0 || idx < TVR_SIZE) {
+        // an expired one runs with the next jiffy
+        if ((int)idx < 0)
+            expires = timer_jiffies;
+        tv1_map[(expires & TVR_MASK) >> 5] |= 0x80000000 >> (expires & 31);
+        vec = tv1 + (expires & TVR_MASK);
+    } else {
+        // the last level takes everything up to 2^31 jiffies ahead
+        for (level = 0; level < TVN_LEVELS - 1; level++) {
+            if (idx < (1 << (TVR_BITS + (level + 1) * TVN_BITS)))
+                break;
+        }
+        vec = tvn[level] + TVN_INDEX(expires, level);
+    }
+    list_add_tail(&(timer->list), vec);
+}
+
+// (timer) must be initialized and not pending, the next timer interrupt is moved up if needed
+void add_timer(struct timer_list *timer) {
+    unsigned int old_ie;
+
+    update_jiffies();
+    old_ie = disable_interrupts();
+    internal_add_timer(timer);
+    ++nr_timers;
+    tick_program();
+    if (old_ie)
+        enable_interrupts();
+}
+
+// return 1 if (timer) was pending
+int del_timer(struct timer_list *timer) {
+    unsigned int old_ie;
+    int ret = 0;
+
+    old_ie = disable_interrupts();
+    if (timer_pending(timer)) {
+        list_del_init(&(timer->list));
+        --nr_timers;
+        ret = 1;
+    }
+    if (old_ie)
+        enable_interrupts();
+    return ret;
+}
+
+// move every timer of tvn[level][index] one level down, return index
+static unsigned int cascade(unsigned int level, unsigned int index) {
+    struct list_head *vec = tvn[level] + index;
+    struct timer_list *timer;
+
+    while (!list_empty(vec)) {
+        timer = container_of(vec->next, struct timer_list, list);
+        list_del(&(timer->list));
+        internal_add_timer(timer);
+    }
+    return index;
+}
+
+/*
+ * run the timers of every jiffy up to now, called from the timer interrupt
+ * jiffies without timers are skipped up to the next wrap of tv1, which has to cascade,
+ * so a long tickless idle costs a step per wrap, and none at all with no timer pending
+ * return the number of timers run
+ */
+unsigned int run_timers() {
+    struct timer_list *timer;
+    struct list_head work;
+    unsigned int index, level, skip;
+    unsigned int ran = 0;
+
+    update_jiffies();
+    while ((int)(jiffies - timer_jiffies) >= 0) {
+        if (!nr_timers) {
+            timer_jiffies = jiffies + 1;
+            break;
+        }
+        index = timer_jiffies & TVR_MASK;
+        // tv1 wrapped, refill it from the first level whose list is not the last one
+        if (!index) {
+            for (level = 0; level < TVN_LEVELS; level++) {
+                if (cascade(level, TVN_INDEX(timer_jiffies, level)))
+                    break;
+            }
+        }
+        skip = tv1_next(index) - index;
+        if (skip) {
+            if (skip > jiffies - timer_jiffies + 1)
+                skip = jiffies - timer_jiffies + 1;
+            timer_jiffies += skip;
+            continue;
+        }
+
+        // take the whole list first, a timer added by a function may go to this same list
+        tv1_map[index >> 5] &= ~(0x80000000 >> (index & 31));
+        ++timer_jiffies;
+        if (list_empty(tv1 + index))
+            continue;
+        work.next = tv1[index].next;
+        work.prev = tv1[index].prev;
+        work.next->prev = &work;
+        work.prev->next = &work;
+        INIT_LIST_HEAD(tv1 + index);
+        while (!list_empty(&work)) {
+            timer = container_of(work.next, struct timer_list, list);
+            list_del_init(&(timer->list));
+            --nr_timers;
+            timer->function(timer->data);
+            ++ran;
+        }
+    }
+    return ran;
+}
+
+/*
+ * CP0 count of the next jiffy that has timers to run, or of the next wrap of tv1
+ * when only later levels hold timers, interrupts must be off
+ * return 0 if there is no timer at all
+ */
+int next_timer_count(unsigned int *count) {
+    unsigned int index = timer_jiffies & TVR_MASK;
+    unsigned int i;
+
+    if (!nr_timers)
+        return 0;
+    i = tv1_next(index) - index;
+    *count = jiffies_count + (int)(timer_jiffies + i - jiffies) * COUNT_PER_MS;
+    return 1;
+}
@@ -2,52 +2,133 @@
 
 #include <driver/ps2.h>
 #include <driver/vga.h>
-#include <zjunix/fs/fat.h>
+#include <page.h>
+#include <zjunix/buddy.h>
 #include <zjunix/pc.h>
-#include <zjunix/slab.h>
 #include <zjunix/utils.h>
+#include <zjunix/vm.h>
 
 #pragma GCC push_options
 #pragma GCC optimize("O0")
-FILE file;
-const unsigned int CACHE_BLOCK_SIZE = 64;
 
+// the parts of an ELF32 image exec() reads, the file is little-endian like the machine
+#define ELF_MAGIC 0x464c457f  // "\177ELF"
+#define PT_LOAD 1
+#define PF_W 0x2
+
+struct elf_header {
+    unsigned int magic;
+    unsigned char ident[12];
+    unsigned short type;
+    unsigned short machine;
+    unsigned int version;
+    unsigned int entry;
+    unsigned int phoff;
+    unsigned int shoff;
+    unsigned int flags;
+    unsigned short ehsize;
+    unsigned short phentsize;
+    unsigned short phnum;
+    unsigned short shentsize;
+    unsigned short shnum;
+    unsigned short shstrndx;
+};
+
+struct elf_phdr {
+    unsigned int type;
+    unsigned int offset;
+    unsigned int vaddr;
+    unsigned int paddr;
+    unsigned int filesz;
+    unsigned int memsz;
+    unsigned int flags;
+    unsigned int align;
+};
+
+/*
+ * one region for every loadable segment of an ELF image, writable only if the segment is,
+ * so text is mapped read-only and shared by the copies mm_dup() makes
+ * the segments must not share a page, as ld lays them out by default
+ * return 1 if the image is broken or memory is used up
+ */
+static int exec_map_elf(struct mm_struct* mm, struct vm_file* file, struct elf_header* header) {
+    struct elf_phdr phdr;
+    unsigned int i, pad, end = 0;
+
+    if (header->phentsize != sizeof(struct elf_phdr))
+        return 1;
+    for (i = 0; i < header->phnum; i++) {
+        if (vm_file_read(file, header->phoff + i * sizeof(struct elf_phdr), &phdr, sizeof(struct elf_phdr)) !=
+            sizeof(struct elf_phdr))
+            return 1;
+        if (phdr.type != PT_LOAD || !phdr.memsz)
+            continue;
+        pad = phdr.vaddr & ((1 << PAGE_SHIFT) - 1);
+        if (phdr.vaddr - pad < end || phdr.offset < pad)
+            return 1;
+        if (mm_add_region(mm, phdr.vaddr - pad, phdr.memsz + pad, (phdr.flags & PF_W) ? ENTRYLO_D : 0,
+                          phdr.filesz ? file : 0, phdr.offset - pad, phdr.filesz ? phdr.filesz + pad : 0))
+            return 1;
+        end = phdr.vaddr + phdr.memsz;
+    }
+    return 0;
+}
+
+/*
+ * run (filename) in an address space of its own
+ * an ELF image gets a region per segment and starts at its entry, a flat image is linked
+ * at 0 and has no sections, so its text and data are one writable region
+ * nothing is read here, each page of the image is loaded by the page fault handler
+ * on its first touch, so a large program only costs the pages it uses
+ */
 int exec(char* filename) {
-    unsigned char buffer[512];
-    int result = fs_open(&file, filename);
-    if (result != 0) {
+    task_struct* pcb = current_task;
+    struct vm_file* file;
+    struct mm_struct* mm;
+    struct elf_header header;
+    unsigned int size, entry;
+    int r;
+
+    file = vm_file_open(filename);
+    if (!file) {
         kernel_printf("File %s not exist\n", filename);
         return 1;
     }
-    unsigned int size = get_entry_filesize(file.entry.data);
-    unsigned int n = size / CACHE_BLOCK_SIZE + 1;
-    unsigned int i = 0;
-    unsigned int j = 0;
-    unsigned int ENTRY = (unsigned int)kmalloc(4096);
-    for (j = 0; j < n; j++) {
-        fs_read(&file, buffer, CACHE_BLOCK_SIZE);
-        kernel_memcpy((void*)(ENTRY + j * CACHE_BLOCK_SIZE), buffer, CACHE_BLOCK_SIZE);
-        kernel_cache(ENTRY + j * CACHE_BLOCK_SIZE);
+    size = vm_file_size(file);
+    mm = mm_create(pcb->ASID);
+    if (!mm) {
+        kernel_printf("Exec: out of memory\n");
+        vm_file_put(file);
+        return 1;
+    }
+    // the regions keep their own references of the file
+    if (vm_file_read(file, 0, &header, sizeof(header)) == sizeof(header) && header.magic == ELF_MAGIC) {
+        entry = header.entry;
+        r = exec_map_elf(mm, file, &header);
+    } else {
+        entry = 0;
+        r = mm_add_region(mm, 0, size, ENTRYLO_D, file, 0, size);
+    }
+    vm_file_put(file);
+    if (r) {
+        kernel_printf("Exec: %s can not be mapped\n", filename);
+        mm_delete(mm);
+        return 1;
     }
-    unsigned int cp0EntryLo0 = ((ENTRY >> 6) & 0x01ffffc0) | 0x1e;
-    asm volatile(
-        "li $t0, 1\n\t"
-        "mtc0 $t0, $10\n\t"
-        "mtc0 $zero, $5\n\t"
-        "move $t0, %0\n\t"
-        "mtc0 $t0, $2\n\t"
-        "mtc0 $zero, $3\n\t"
-        "mtc0 $zero, $0\n\t"
-        "nop\n\t"
-        "nop\n\t"
-        "tlbwi"
-        : "=r"(cp0EntryLo0));
-    int (*f)() = (int (*)())(0);
+
+    // the scheduler switches to pcb->mm whenever this task runs again
+    pcb->mm = mm;
+    mm_switch(mm, pcb->ASID);
+    int (*f)() = (int (*)())(entry);
+#ifdef EXEC_DEBUG
+    unsigned int faults = page_faults;
+#endif  // ! EXEC_DEBUG
+    r = f();
 #ifdef EXEC_DEBUG
-    kernel_printf("Exec load at: 0x%x\n", ENTRY);
+    kernel_printf("Exec: %d page faults for %d bytes\n", page_faults - faults, size);
 #endif  // ! EXEC_DEBUG
-    int r = f();
-    kfree((void*)ENTRY);
+    pcb->mm = 0;
+    mm_delete(mm);
     return r;
 }
-#pragma GCC pop_options
\ No newline at end of file
+#pragma GCC pop_options
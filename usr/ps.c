@@ -8,6 +8,8 @@
 #include <zjunix/slab.h>
 #include <zjunix/time.h>
 #include <zjunix/utils.h>
+#include <zjunix/vm.h>
+#include <zjunix/vmalloc.h>
 #include "../usr/ls.h"
 #include "exec.h"
 #include "myvi.h"
@@ -127,6 +129,23 @@ void parse_cmd() {
     } else if (kernel_strcmp(ps_buffer, "mminfo") == 0) {
         bootmap_info("bootmm");
         buddy_info();
+        slab_info();
+        vmalloc_info();
+    } else if (kernel_strcmp(ps_buffer, "fraginfo") == 0) {
+        buddy_fraginfo();
+    } else if (kernel_strcmp(ps_buffer, "mmbench") == 0) {
+        buddy_bench();
+    } else if (kernel_strcmp(ps_buffer, "tlbinfo") == 0) {
+        // refills since the last tlbinfo, run it before and after a workload
+        kernel_printf("TLB refills : %d, page faults : %d\n", tlb_refills, page_faults);
+        tlb_refills = 0;
+        page_faults = 0;
+    } else if (kernel_strcmp(ps_buffer, "tlbbench") == 0) {
+        tlb_bench();
+    } else if (kernel_strcmp(ps_buffer, "cowtest") == 0) {
+        cow_test();
+    } else if (kernel_strcmp(ps_buffer, "switchbench") == 0) {
+        switch_bench();
     } else if (kernel_strcmp(ps_buffer, "mmtest") == 0) {
         kernel_printf("kmalloc : %x, size = 1KB\n", kmalloc(1024));
     } else if (kernel_strcmp(ps_buffer, "ps") == 0) {
@@ -20,6 +20,20 @@ void* kernel_memset(void* dest, int b, int len) {
 #endif  // ! MEMSET_DEBUG
     char content = b ? -1 : 0;
     char* deststr = dest;
+    unsigned int* destword;
+    // bytes up to a word boundary, then whole words, then the tail
+    while (len && ((unsigned int)deststr & 3)) {
+        *deststr = content;
+        deststr++;
+        len--;
+    }
+    destword = (unsigned int*)deststr;
+    while (len >= 4) {
+        *destword = b ? 0xffffffff : 0;
+        destword++;
+        len -= 4;
+    }
+    deststr = (char*)destword;
     while (len--) {
         *deststr = content;
         deststr++;